@@ -1,475 +1,5229 @@
 #define _XOPEN_SOURCE_EXTENDED // Must be first.
+#define _POSIX_C_SOURCE 200809L // clock_nanosleep.
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <time.h>
 #include <locale.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifndef SNAKE_HEADLESS
 #include <ncursesw/curses.h> // Should be last.
+#else
+// Val: Headless build (-DSNAKE_HEADLESS) has no curses, but the simulation
+// still speaks in curses key codes, so use the same values.
+#define KEY_DOWN 0402
+#define KEY_UP 0403
+#define KEY_LEFT 0404
+#define KEY_RIGHT 0405
+#define TRUE 1
+#define FALSE 0
+#include <pthread.h>
+#include <stdarg.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#endif
 
 // Adam: Tick-based game (so trophies can be generated at time intervals).
 #define TICKS_PER_SECOND 50
-static const int USECS_PER_TICK = 1000000 / TICKS_PER_SECOND;
-static const int TICKS_PER_MOVE_MAX = TICKS_PER_SECOND / 4;
-static const int TICKS_PER_MOVE_MIN = 3;
+static const long NSECS_PER_TICK = 1000000000L / TICKS_PER_SECOND;
+#define TICKS_PER_MOVE_MAX (TICKS_PER_SECOND / 4)
+#define TICKS_PER_MOVE_MIN 3
+
+// Val: Speed curves (-d): ticks per move from length 0 (slow) to the winning
+// length (fast), in SPEED_ONEths of a tick. reset_snake turns the game's curve
+// into a table with an entry per length, so a move's speed is one lookup. The
+// fraction carries over to the next move, so 4.5 ticks a move alternates 4
+// and 5. A stepped curve is whole ticks only, one fewer at a time, like the
+// original one.
+#define SPEED_ONE 256
+#define SPEED_TICKS_MAX 60 // Slowest: every move within a server timer wheel lap.
+struct SpeedCurve {
+  int slow;
+  int fast;
+  int stepped;
+};
+struct SpeedProfile {
+  const char *name;
+  struct SpeedCurve curve;
+};
+static const struct SpeedProfile speed_profiles[] = {
+  { "classic", { TICKS_PER_MOVE_MAX * SPEED_ONE, TICKS_PER_MOVE_MIN * SPEED_ONE, TRUE } },
+  { "smooth", { TICKS_PER_MOVE_MAX * SPEED_ONE, TICKS_PER_MOVE_MIN * SPEED_ONE, FALSE } },
+  { "easy", { 16 * SPEED_ONE, 6 * SPEED_ONE, FALSE } },
+  { "hard", { 8 * SPEED_ONE, 3 * SPEED_ONE / 2, FALSE } },
+};
+#define SPEED_PROFILES (sizeof(speed_profiles) / sizeof(speed_profiles[0]))
+
+// Val: Speed table entries for a ring of this size (lengths 0 to ring), kept
+// even so what follows in the block stays int-aligned.
+#define SPEED_TABLE_LEN(ring) (((ring) + 2) & ~1)
+
+// Val: Late ticks run back-to-back to catch up, but only this many;
+// past that the schedule is resynced to now instead.
+static const int TICKS_CATCHUP_MAX = TICKS_PER_SECOND / 10;
+
+// Val: Fixed-timestep scheduler on absolute monotonic deadlines.
+struct TickClock {
+  struct timespec deadline;
+  long long tick_ns;       // NSECS_PER_TICK, shorter for fast-forwarded replays.
+  long long jitter_ns;     // How late the last tick started.
+  long long jitter_max_ns; // Worst lateness seen.
+  long long jitter_sum_ns; // For the average (divide by ticks).
+  long long ticks;
+  long long overruns;      // Ticks whose deadline had passed before we got to wait.
+  long long resyncs;       // Times we fell too far behind and dropped ticks.
+};
+
+// Val: Tick profiler (build with -DSNAKE_PROFILE, terminal game only): time
+// spent in each phase of a tick goes into a log-linear histogram, 8 buckets
+// per power of two (values within 12.5%), so recording is a few instructions
+// and percentiles come out of a bucket walk. Printed on exit; 'p' toggles an
+// overlay. Without the flag PROFILE_START/PROFILE_END compile to nothing.
+#if defined(SNAKE_PROFILE) && !defined(SNAKE_HEADLESS)
+enum ProfilePhase {
+  PHASE_INPUT,   // read_input
+  PHASE_MOVE,    // update_next_head
+  PHASE_AWARD,   // award_trophy
+  PHASE_TROPHY,  // generate_trophy
+  PHASE_DRAW,    // draw_snake
+  PHASE_FLUSH,   // flush_frame (terminal output)
+  PHASE_SLEEP,   // Waiting for the next tick.
+  PHASES
+};
+#define PROFILE_SUB_BITS 3
+#define PROFILE_BUCKETS (64 << PROFILE_SUB_BITS)
+struct Histogram {
+  long long count;
+  long long max;
+  unsigned int buckets[PROFILE_BUCKETS];
+};
+static struct Histogram profile[PHASES];
+
+// Val: Monotonic time in ns.
+long long profile_now();
+
+// Val: Record one duration.
+void histogram_add(struct Histogram *histogram, long long ns);
+
+#define PROFILE_START(name) long long name = profile_now()
+#define PROFILE_END(phase, start) histogram_add(&profile[phase], profile_now() - (start))
+#else
+#define PROFILE_START(name)
+#define PROFILE_END(phase, start)
+#endif
+
+#ifndef SNAKE_HEADLESS
+static struct TickClock tick_clock;
+
+// Val: Event-driven mode (-e): instead of waking every tick, block on stdin
+// until a key arrives or the next move/trophy expiry is due.
+static int event_driven = FALSE;
+#endif
+
+// Val: Turns read every tick but not yet applied, oldest first.
+// Bounded so mashed keys can't build up a long backlog.
+#define TURN_QUEUE_MAX 4
 
 // Adam: Constants for game state.
 #define PLAYING 0
 #define LOSS -1
 #define WIN 1
 
-// Adam: Data holder for screen coordinates.
-struct Coord {
-  int r;
-  int c;
-};
+// Adam: Data holder for screen coordinates.
+struct Coord {
+  int r;
+  int c;
+};
+
+// Val: Trophy on the board. Its value is kept here, not read back from the screen.
+struct Trophy {
+  struct Coord pos;
+  int value; // 1-9, 0 if there is no trophy.
+};
+
+// Val: Small fast PRNG (PCG32). Each game owns one, so games don't share
+// or disturb each other's sequences.
+struct Rng {
+  uint64_t state;
+  uint64_t inc;
+};
+
+// Val: Snakes sharing one pit. Owner ids in the occupancy grid are one byte
+// (0 is an empty cell), which caps the count.
+#define SNAKES_MAX 255
+
+// Val: Snake rings hold cells packed into 32 bits, row in the high half and
+// column in the low (a side is at most 65535, see parse_board). Half the size
+// of a Coord, and comparing two is one integer compare.
+#define CELL_PACK(r, c) ((uint32_t) (r) << 16 | (uint32_t) (c))
+#define CELL_R(cell) ((int) ((cell) >> 16))
+#define CELL_C(cell) ((int) ((cell) & 0xFFFF))
+
+// Adam: Snake data tracking.
+// elements is a ring of snake_win_len slots holding the body from
+// tail_ptr to head_ptr. len counts growth still to come.
+// Val: One per snake on the board, each with its own speed and turn queue.
+// Only body_len slots from tail_ptr are in use; nothing in a slot marks it empty.
+struct Snake {
+  int len;
+  int body_len;  // Segments actually on the board.
+  int growth;    // Moves left where the tail stays put.
+  int head_ptr;
+  int tail_ptr;
+  int dir;
+  int prev_dir;
+  int alive;
+  int ticks_per_move;
+  int ticks_since_move;
+  int speed_carry; // Fraction of a tick (in SPEED_ONEths) owed to the next move.
+  // Turns queued by the player or bot (see TURN_QUEUE_MAX).
+  int turn_queue[TURN_QUEUE_MAX];
+  int turn_queue_head;
+  int turn_queue_len;
+  uint32_t *elements;
+};
+
+// Val: One snake's move during a tick.
+struct SnakeMove {
+  int snake;              // Index in game->snakes; head is at its head_ptr.
+  int tail_moved;         // Tail vacated discarded (FALSE while growing).
+  struct Coord discarded;
+  int ate;                // Value of the trophy eaten (0 if none).
+};
+
+// Val: What one simulation step did, so a renderer (or nothing) can follow along.
+// Only the first moved entries of moves are filled in (and nothing else is cleared).
+struct TickEvents {
+  int moved;              // Snakes that advanced, in the order they moved.
+  struct SnakeMove moves[SNAKES_MAX];
+  int ate;                // Total value of the trophies eaten (0 if none).
+  int died;               // Snakes that died.
+  int trophy_erased;      // Old trophy at erased_trophy expired.
+  struct Coord erased_trophy;
+  int trophy_spawned;     // New trophy placed at trophy.pos.
+  int spawn_misses;       // Cells drawn for it that weren't free (sparse boards).
+  char *message;          // Feedback for the player (NULL if none).
+};
+
+// Val: Replay recording/playback (-r/-p). File layout, little-endian:
+//   "SNKR", u8 version, u8 ticks per second, u16 lines, u16 cols, u64 seed,
+//   u32 winning length (0 for half the perimeter),
+//   u16 slow, u16 fast, u8 stepped: the speed curve,
+//   then per recorded turn: varint moves since the previous turn, u8 turn code,
+//   ending with varint moves until game over, REPLAY_END, i8 final game state.
+// Moves that keep the current direction aren't stored at all.
+#define REPLAY_OFF 0
+#define REPLAY_RECORD 1
+#define REPLAY_PLAY 2
+#define REPLAY_VERSION 4
+#define REPLAY_HEADER_SIZE 27
+#define REPLAY_END 0xFF
+#define REPLAY_BUFFER_SIZE 4096
+struct Replay {
+  int mode;
+  FILE *file;
+  unsigned char *data;   // Recording: append buffer. Playback: whole file.
+  size_t len;
+  size_t pos;            // Playback read position.
+  long long run;         // Moves since the last turn (recording) or until the next (playback).
+  int code;              // Playback: turn code due after run moves.
+  int final_state;       // Playback: how the recorded game ended.
+};
+
+// Val: Boards with more cells than SPARSE_CELLS (far bigger than any screen)
+// don't get a dense grid and free-cell index, which would cost bytes per cell of
+// board. Occupancy lives in PIT_CHUNK x PIT_CHUNK chunks instead, handed out as
+// snakes move into them and taken back once empty, so memory follows the snakes.
+#define SPARSE_CELLS (1 << 22)
+#define SPARSE_TRIES 64
+#define PIT_CHUNK 64
+struct PitChunk {
+  int used;                // Occupied cells.
+  struct PitChunk *next;   // Next spare chunk.
+  unsigned char cells[PIT_CHUNK * PIT_CHUNK];
+};
+
+// Val: Everything one game needs. Nothing in the simulation is global, so
+// any number of games can run side by side (batch threads, servers, split screen).
+// Zero-initialised is a valid "no game yet" state; reset_snake sets up the rest.
+struct GameState {
+  // Pit size including the border. Set from the screen (or command line
+  // when headless) before each game; the simulation never reads LINES/COLS.
+  int pit_lines;
+  int pit_cols;
+
+  // Val: Snakes on the board (snake_count of them, all with snake_win_len slot rings).
+  struct Snake *snakes;
+  int snake_count;
+  int snakes_alive;
+  int snake_win_len;
+  int win_len; // Winning length to use, 0 for half the perimeter.
+  struct SpeedCurve speed; // Speed curve to use, all zero for classic.
+
+  // Val: Trophy and its expiry, advanced by sim_tick.
+  struct Trophy trophy;
+  int ticks_till_new_trophy;
+
+  // Val: Seed for the next reset_snake. Same seed and same turns, same game.
+  unsigned long long seed;
+  struct Rng rng;
+
+  // Val: Free-cell index: dense array of unoccupied pit cells plus each cell's
+  // position in it, so trophies are placed with a single uniform draw.
+  int free_cells_count;
+
+  // Adam: Pit occupancy, one byte per screen cell (non-zero means snake).
+  // Val: The byte is the owning snake's index + 1, so a head can tell whose
+  // body it hit. Kept in sync by advance_snake so collision checks are O(1).
+  // Snakes, rings, speed table, free-cell index and grid share one allocation (block), in that order.
+  // Val: The speed table (see SpeedCurve) goes between the rings and the index.
+  uint16_t *speed_table;
+  int *free_cells;
+  int *free_cells_pos;
+  unsigned char *pit_cells;
+  void *block;
+  int snakes_size; // Snakes (and rings) in block.
+  int ring_size;   // Slots per ring in block.
+  int cells_size;  // Pit cells the index and grid in block have room for.
+
+  // Val: Sparse boards only (NULL otherwise): chunk_rows x chunk_cols chunk
+  // pointers, NULL where no snake is. free_cells_count is still kept up to date.
+  struct PitChunk **chunks;
+  int chunk_rows;
+  int chunk_cols;
+  int chunks_size;                 // Pointers chunks has room for.
+  struct PitChunk *spare_chunks;   // Emptied chunks, kept for reuse.
+
+  struct Replay replay;
+};
+
+// Val: A ring cell as a Coord.
+static inline struct Coord cell_coord(uint32_t cell) {
+  struct Coord pos = { CELL_R(cell), CELL_C(cell) };
+  return pos;
+}
+
+// Val: Owner of a pit cell (0 if free), dense or sparse.
+static inline int pit_owner(const struct GameState *game, int r, int c) {
+  if (game->chunks == NULL) {
+    return game->pit_cells[r * game->pit_cols + c];
+  }
+  struct PitChunk *chunk = game->chunks[r / PIT_CHUNK * game->chunk_cols + c / PIT_CHUNK];
+  return chunk != NULL ? chunk->cells[r % PIT_CHUNK * PIT_CHUNK + c % PIT_CHUNK] : 0;
+}
+
+// Val: Snapshots: everything a game is, as one flat buffer that restores with
+// a few memcpys and no parsing. Layout, native byte order and struct layout:
+//   SnapshotHeader, the GameState (pointers zeroed), its block byte for byte,
+//   then on sparse boards each chunk in use as a u32 chunk index and its cells.
+// Sizes are checked on restore, so a build whose structs differ (another
+// architecture, another version of the game) refuses the file instead of
+// misreading it. Replays aren't part of a snapshot.
+#define SNAPSHOT_VERSION 2
+struct SnapshotHeader {
+  char magic[4];         // "SNKS"
+  uint32_t version;
+  uint32_t game_size;    // sizeof(struct GameState)
+  uint32_t snake_size;   // sizeof(struct Snake)
+  uint64_t block_size;
+  uint64_t chunks;       // Chunks after the block.
+  uint64_t size;         // Whole snapshot.
+};
+
+// Val: Metrics page (-M): counters for anything on the machine to read by
+// mapping the file (put it in /dev/shm to keep it off the disk). Layout,
+// native byte order: "SNKM", u32 version, u32 pid, u32 count, then count u64
+// values in metric_names order. Each value is updated with relaxed atomic
+// adds, so a reader never sees one half-written, but the values aren't all
+// from the same instant. Hot loops tally into a plain
+// array of their own and metrics_flush adds it to the page now and then.
+// The file stays after exit with the last values; the pid tells whose they
+// were.
+#define METRICS_VERSION 1
+enum Metric {
+  METRIC_TICKS,          // Ticks run (the server's, or simulated when headless).
+  METRIC_TICK_OVERRUNS,  // Ticks whose deadline passed before we got to them.
+  METRIC_MOVES,
+  METRIC_EATS,
+  METRIC_TROPHY_SPAWNS,
+  METRIC_SPAWN_MISSES,   // Cells drawn for trophies that weren't free (sparse boards).
+  METRIC_INPUTS_DROPPED, // Turns dropped on a full queue, and keys left unread at game over.
+  METRIC_RENDER_BYTES,   // Sent to the terminal, or to players by the server.
+  METRIC_GAMES,          // Games started.
+  METRIC_SESSIONS,       // Gauge: players connected to the server.
+  METRIC_SPECTATORS,     // Gauge: spectators connected to the server.
+  METRIC_COUNT
+};
+static const char *const metric_names[METRIC_COUNT] = {
+  "ticks", "tick_overruns", "moves", "eats", "trophy_spawns", "spawn_misses",
+  "inputs_dropped", "render_bytes", "games", "sessions", "spectators",
+};
+struct MetricsPage {
+  char magic[4];
+  uint32_t version;
+  uint32_t pid;
+  uint32_t count;
+  _Atomic uint64_t values[METRIC_COUNT];
+};
+static struct MetricsPage *metrics = NULL; // NULL unless -M.
+
+// Note: default color may be -1 on some systems. Ours is 0.
+#define COLOR_DEFAULT 0
+#define COLOR_SNAKE 1
+#define COLOR_TROPHY 2
+
+// Val: Everything that can be drawn in a pit cell. Drawing code only picks
+// glyphs; the renderer decides what they look like.
+enum Glyph {
+  GLYPH_BLANK,
+  GLYPH_TROPHY,          // Plus value - 1, for trophies 1-9.
+  GLYPH_HEAD_UP = GLYPH_TROPHY + 9,
+  GLYPH_HEAD_DOWN,
+  GLYPH_HEAD_LEFT,
+  GLYPH_HEAD_RIGHT,
+  GLYPH_HEAD_OTHER,
+  GLYPH_BODY_VERTICAL,   // ║
+  GLYPH_BODY_HORIZONTAL, // ═
+  GLYPH_BODY_UP_LEFT,    // ╝
+  GLYPH_BODY_UP_RIGHT,   // ╚
+  GLYPH_BODY_DOWN_LEFT,  // ╗
+  GLYPH_BODY_DOWN_RIGHT, // ╔
+  GLYPH_TAIL_UP,         // ╜
+  GLYPH_TAIL_DOWN,       // ╓
+  GLYPH_TAIL_LEFT,       // ╕
+  GLYPH_TAIL_RIGHT,      // ╘
+  GLYPH_COUNT
+};
+
+// Val: Looks for the glyphs, picked at startup (-a for ASCII).
+enum Theme {
+  THEME_UNICODE,
+  THEME_ASCII,
+  THEMES
+};
+
+// Val: Arrow keys are consecutive (down, up, left, right), which makes them
+// table indices 0-3. dir is always an arrow by the time a snake is drawn.
+#define DIR_INDEX(dir) ((dir) - KEY_DOWN)
+
+// Val: Cells changed during one tick, flushed to the screen together.
+// A tick touches at most tail, tail tip, neck, head and two trophy cells.
+#define FRAME_CELLS_MAX 16
+struct CellUpdate {
+  struct Coord pos;
+  int glyph;
+};
+struct Frame {
+  struct CellUpdate cells[FRAME_CELLS_MAX];
+  int count;
+};
+
+// Val: What a controller sees of the game when its snake is about to move.
+// Filled in from the game state as it is (nothing copied but these fields,
+// nothing rendered); the pit itself is read through observe_cell.
+#define OBSERVE_WALL -1
+struct Observation {
+  const struct GameState *game;
+  int snake;             // Index in game->snakes.
+  struct Coord head;
+  int dir;
+  int len;
+  int win_len;
+  struct Trophy trophy;  // value 0 if there's none.
+  int pit_lines;
+  int pit_cols;
+};
+
+// Val: Scratch for controllers, one per thread driving games: a random
+// stream and a search window of BOT_WINDOW x BOT_WINDOW cells around the head.
+#define BOT_WINDOW 128
+struct Bot {
+  struct Rng rng;
+  uint32_t generation;                           // Marks this search's cells in seen.
+  uint32_t seen[BOT_WINDOW * BOT_WINDOW];
+  unsigned char first[BOT_WINDOW * BOT_WINDOW];  // First step on the way there.
+  uint16_t queue[BOT_WINDOW * BOT_WINDOW];
+};
+
+// Val: Controllers (-i): something that steers a snake, asked for a key right
+// before each of its moves. Returns an arrow, or anything else to keep going.
+struct Controller {
+  const char *name;
+  int (*decide)(struct Bot *bot, const struct Observation *observation);
+};
+
+// Adam: Set up a new snake.
+// Val: Or game->snake_count of them (at least one) on a shared pit.
+// Returns FALSE (game freed) if out of memory.
+int reset_snake(struct GameState *game, struct TickEvents *events);
+
+// Val: Release a game's memory (the GameState itself belongs to the caller).
+void free_game(struct GameState *game);
+
+// Val: Point snakes, rings, speed table, free-cell index and grid into the block.
+void layout_block(struct GameState *game);
+
+// Val: Bytes a block for these many snakes, ring slots and pit cells takes.
+size_t game_block_size(int snakes, int ring, int cells);
+
+// Val: Rebuild the free-cell index from the grid.
+void index_free_cells(struct GameState *game);
+
+// Val: Fill in the speed table from the game's curve (classic if it has none).
+void build_speed_table(struct GameState *game);
+
+// Val: Read a speed curve: a profile name, or SLOW:FAST ticks per move (a
+// smooth curve, fractions allowed). Returns FALSE unless 1 <= FAST <= SLOW <= SPEED_TICKS_MAX.
+int parse_speed(const char *text, struct SpeedCurve *curve);
+
+// Val: Change the pit size mid-game, keeping everything on it where it is
+// (so never smaller than what's on it). Returns FALSE if nothing changed.
+int resize_pit(struct GameState *game, int lines, int cols);
+
+// Val: Reset events for a new step (the moves array is left as it is).
+void clear_events(struct TickEvents *events);
+
+// Val: Advance the game by some ticks. Returns game state.
+int sim_tick(struct GameState *game, int ticks, struct TickEvents *events);
+
+// Val: Ticks until the next move or trophy expiry (nothing happens before then).
+int sim_idle_ticks(struct GameState *game);
+
+// Adam: Length-based speed.
+// Val: Looked up in the speed table; what's left of a tick goes to the next move.
+int get_ticks_per_move(struct GameState *game, struct Snake *snake);
+
+// Val: Start the tick schedule from now.
+void tick_clock_start(struct TickClock *clock, long long tick_ns);
+
+// Val: Wait for the next tick deadline.
+void tick_clock_wait(struct TickClock *clock);
+
+// Val: Nanoseconds from b to a.
+static long long timespec_diff_ns(const struct timespec *a, const struct timespec *b);
+
+// Val: Block until max_ticks ticks have passed or stdin has input. Returns ticks elapsed.
+int tick_clock_wait_event(struct TickClock *clock, int max_ticks);
+
+// Val: Generate a new trophy.
+void generate_trophy(struct GameState *game, struct TickEvents *events);
+
+// Val: Pick a free cell inside the border uniformly. Returns FALSE if there's none.
+// Cells drawn that weren't free are added to misses (unless it's NULL).
+int random_free_cell(struct GameState *game, struct Coord *pos, int *misses);
+
+// Val: Free (zero) bytes among n grid cells.
+int count_free(const unsigned char *cells, int n);
+
+// Val: Chunk holding a cell on a sparse board, handed out if create and
+// there's none yet (NULL if there's none, or no memory for one).
+struct PitChunk *pit_chunk(struct GameState *game, int r, int c, int create);
+
+// Val: Mark a pit cell as occupied by a snake (owner is its index + 1).
+void take_cell(struct GameState *game, int r, int c, int owner);
+
+// Val: Mark a pit cell as free again.
+void release_cell(struct GameState *game, int r, int c);
+
+// Val: Add a key to the turn queue (arrows and cheat codes only). Returns
+// FALSE if it was dropped because the queue is full.
+int queue_turn(struct Snake *snake, int key);
+
+// Val: Take the next queued turn (current direction if none).
+int next_turn(struct Snake *snake);
+
+// Val: Fill in what a snake sees of its game.
+void observe(struct GameState *game, int snake, struct Observation *observation);
+
+// Val: What's in a pit cell: 0 if free, the owning snake's index + 1, or
+// OBSERVE_WALL for the border and anything outside it.
+int observe_cell(const struct Observation *observation, int r, int c);
+
+// Val: Controller by name (NULL if there's no such one).
+const struct Controller *find_controller(const char *name);
+
+// Val: Queue a turn from the controller for every live snake moving within ticks.
+void poll_controller(struct GameState *game, const struct Controller *controller, struct Bot *bot, int ticks);
+
+// Val: Random bot: usually straight, sometimes a random turn, never into
+// something if it can be helped.
+int random_bot(struct Bot *bot, const struct Observation *observation);
+
+// Val: Path bot: shortest path to the trophy when there's room to survive
+// getting there, otherwise the move that keeps the most room, toward the trophy.
+int path_bot(struct Bot *bot, const struct Observation *observation);
+
+// Val: Collision check and update next head.
+int update_next_head(struct GameState *game, struct Snake *snake, int input, struct Coord *next_head, struct TickEvents *events);
+
+// Adam: Consume trophy and grow snake. Returns value eaten (0 if none).
+int award_trophy(struct GameState *game, struct Snake *snake, struct Coord *next_head);
+
+// Adam: Finalize move with new head.
+void advance_snake(struct GameState *game, struct Snake *snake, struct Coord *head, struct SnakeMove *move);
+
+// Val: Take a dead snake off the board.
+void kill_snake(struct GameState *game, struct Snake *snake);
+
+// Val: Seed a PRNG; any seed (including nearby ones) gives an independent stream.
+void rng_seed(struct Rng *rng, uint64_t seed);
+
+// Val: Next 32 random bits.
+uint32_t rng_next(struct Rng *rng);
+
+// Val: Uniform random number in [0, bound), without modulo bias.
+uint32_t rng_below(struct Rng *rng, uint32_t bound);
+
+// Val: Fresh seed for a new game (time in ns, pid).
+uint64_t new_game_seed();
+
+// Val: Read a COLSxLINES board size. Returns FALSE unless it's at least 4x4,
+// fits a replay header (u16 a side) and has cells an int can number.
+int parse_board(const char *text, int *lines, int *cols);
+
+// Val: Start recording the game just reset into a replay file. Returns FALSE on error.
+int replay_record_start(struct GameState *game, const char *path);
+
+// Val: Note the input applied on a move.
+void replay_record(struct GameState *game, int input);
+
+// Val: Finish the replay file with how the game ended.
+void replay_record_finish(struct GameState *game, int game_state);
+
+// Val: Load a replay; sets the seed and pit size for reset_snake. Returns FALSE on error.
+int replay_load(struct GameState *game, const char *path);
+
+// Val: Recorded input for the next move.
+int replay_next_input(struct GameState *game);
+
+// Val: Bytes snapshot_save needs for this game.
+size_t snapshot_size(const struct GameState *game);
+
+// Val: Write a snapshot of the game into buf. Returns its size, 0 if buf is too small.
+size_t snapshot_save(const struct GameState *game, void *buf, size_t size);
+
+// Val: Replace the game with a snapshot's. Returns FALSE if it isn't a
+// snapshot this build can read, or memory ran out (the game is untouched either way).
+int snapshot_restore(struct GameState *game, const void *buf, size_t size);
+
+// Val: Whether a game laid out from a snapshot's block is one the
+// simulation can run: every index and position in range, the free-cell
+// index agreeing with the grid.
+int snapshot_check(const struct GameState *game);
+
+// Val: Save a snapshot to a file. Returns FALSE on error.
+int snapshot_write(const struct GameState *game, const char *path);
+
+// Val: Restore a snapshot from a file (mapped, not read). Returns FALSE on error.
+int snapshot_read(struct GameState *game, const char *path);
+
+// Val: Make dst an independent copy of src, for searching ahead. dst is a game
+// (or zeroed); its memory is reused when it has the same shape. Returns FALSE
+// (dst freed) if out of memory.
+int fork_game(struct GameState *dst, const struct GameState *src);
+
+// Val: Clear a list of chunks and put them on the game's spares.
+void spare_chunks_clear(struct GameState *game, struct PitChunk *chunks);
+
+// Val: Create the metrics page at path and start publishing to it. Returns FALSE on error.
+int metrics_open(const char *path);
+
+// Val: Tally what a tick did (ticks of it) into a tally array.
+void metrics_tally(uint64_t *tally, const struct TickEvents *events, int ticks);
+
+// Val: Add a tally to the page (if there is one) and zero it.
+void metrics_flush(uint64_t *tally);
+
+// Val: Set a gauge on the page (if there is one).
+void metrics_set(int metric, uint64_t value);
+
+// Val: Print another process's metrics page, one "name value" line each.
+// Returns FALSE if it isn't one.
+int metrics_print(const char *path, FILE *out);
+
+// Val: Queue a glyph for a cell in this frame.
+void frame_put(struct Frame *frame, struct Coord pos, int glyph);
+
+// Adam: Draw snake with new head.
+void draw_snake(struct GameState *game, struct SnakeMove *move, struct Frame *frame);
+
+// Val: Draw the current trophy.
+void draw_trophy(struct GameState *game, struct Frame *frame);
+
+// Val: Glyph for a head going dir.
+int head_glyph(int dir);
+
+// Val: Glyph for a segment entered going prev_dir and left going dir.
+int body_glyph(int prev_dir, int dir);
+
+// Val: Glyph for the tail tip, given the segment after it.
+int tail_glyph(struct Coord tail, struct Coord tail_prev);
+
+// Val: Glyph a snake's segment (counted from the tail) was drawn with.
+int segment_glyph(struct GameState *game, struct Snake *snake, int segment);
+
+#ifndef SNAKE_HEADLESS
+// Val: Terminal output counters.
+struct RenderStats {
+  long long frames;
+  long long bytes;
+  long long bytes_max; // Largest single frame.
+};
+static struct RenderStats render_stats;
+
+// Val: HUD: status fields drawn into the border. Each field has a fixed slot
+// and remembers what it shows, so updates only rewrite changed characters.
+enum HudFieldId {
+  HUD_LENGTH,
+  HUD_WIN,
+  HUD_FPS,
+  HUD_TICK,
+  HUD_FIELDS
+};
+#define HUD_WIDTH_MAX 8
+struct HudField {
+  struct Coord pos;  // Where the value starts.
+  int width;         // Value width, 0 if the field doesn't fit on screen.
+  long value;
+  char shown[HUD_WIDTH_MAX + 1];
+};
+
+// Val: Where and how a game is shown: its window plus the text drawn on top.
+// One per game on screen; the renderer never touches stdscr directly.
+struct View {
+  WINDOW *win;
+  struct HudField hud[HUD_FIELDS];
+  int text_dirty;            // Text (HUD, feedback) changed since the last flush.
+  struct Coord feedback_pos; // Last feedback message, so the next one can clear it.
+  int feedback_len;
+  // Camera: screen cell (r, c) shows pit cell origin + (r, c). lines x cols
+  // is the pit when it fits on screen (origin 0, 0). A bigger pit is seen
+  // through the whole screen, framed by a border of its own, following the head.
+  struct Coord origin;
+  int lines;
+  int cols;
+#ifdef SNAKE_PROFILE
+  WINDOW *profile_win;       // Profiler overlay, NULL while hidden.
+#endif
+};
+
+// Val: How each glyph looks on the terminal, per theme (glyph_styles is the one in use).
+struct GlyphStyle {
+  const wchar_t *text;
+  short color;
+};
+static const struct GlyphStyle glyph_themes[THEMES][GLYPH_COUNT] = {
+  [THEME_UNICODE] = {
+    [GLYPH_BLANK] = { L" ", COLOR_DEFAULT },
+    [GLYPH_TROPHY] = { L"1", COLOR_TROPHY }, // Adam: Colors!
+    [GLYPH_TROPHY + 1] = { L"2", COLOR_TROPHY },
+    [GLYPH_TROPHY + 2] = { L"3", COLOR_TROPHY },
+    [GLYPH_TROPHY + 3] = { L"4", COLOR_TROPHY },
+    [GLYPH_TROPHY + 4] = { L"5", COLOR_TROPHY },
+    [GLYPH_TROPHY + 5] = { L"6", COLOR_TROPHY },
+    [GLYPH_TROPHY + 6] = { L"7", COLOR_TROPHY },
+    [GLYPH_TROPHY + 7] = { L"8", COLOR_TROPHY },
+    [GLYPH_TROPHY + 8] = { L"9", COLOR_TROPHY },
+    [GLYPH_HEAD_UP] = { L"\u2809", COLOR_SNAKE }, // ⠉
+    [GLYPH_HEAD_DOWN] = { L"\u28C0", COLOR_SNAKE }, // ⣀
+    [GLYPH_HEAD_LEFT] = { L"\u2806", COLOR_SNAKE }, // ⠆
+    [GLYPH_HEAD_RIGHT] = { L"\u2830", COLOR_SNAKE }, // ⠰
+    [GLYPH_HEAD_OTHER] = { L"@", COLOR_SNAKE },
+    [GLYPH_BODY_VERTICAL] = { L"\u2551", COLOR_SNAKE }, // ║
+    [GLYPH_BODY_HORIZONTAL] = { L"\u2550", COLOR_SNAKE }, // ═
+    [GLYPH_BODY_UP_LEFT] = { L"\u255D", COLOR_SNAKE }, // ╝
+    [GLYPH_BODY_UP_RIGHT] = { L"\u255A", COLOR_SNAKE }, // ╚
+    [GLYPH_BODY_DOWN_LEFT] = { L"\u2557", COLOR_SNAKE }, // ╗
+    [GLYPH_BODY_DOWN_RIGHT] = { L"\u2554", COLOR_SNAKE }, // ╔
+    [GLYPH_TAIL_UP] = { L"\u255C", COLOR_SNAKE }, // ╜
+    [GLYPH_TAIL_DOWN] = { L"\u2553", COLOR_SNAKE }, // ╓
+    [GLYPH_TAIL_LEFT] = { L"\u2555", COLOR_SNAKE }, // ╕
+    [GLYPH_TAIL_RIGHT] = { L"\u2558", COLOR_SNAKE }, // ╘
+  },
+  [THEME_ASCII] = {
+    [GLYPH_BLANK] = { L" ", COLOR_DEFAULT },
+    [GLYPH_TROPHY] = { L"1", COLOR_TROPHY },
+    [GLYPH_TROPHY + 1] = { L"2", COLOR_TROPHY },
+    [GLYPH_TROPHY + 2] = { L"3", COLOR_TROPHY },
+    [GLYPH_TROPHY + 3] = { L"4", COLOR_TROPHY },
+    [GLYPH_TROPHY + 4] = { L"5", COLOR_TROPHY },
+    [GLYPH_TROPHY + 5] = { L"6", COLOR_TROPHY },
+    [GLYPH_TROPHY + 6] = { L"7", COLOR_TROPHY },
+    [GLYPH_TROPHY + 7] = { L"8", COLOR_TROPHY },
+    [GLYPH_TROPHY + 8] = { L"9", COLOR_TROPHY },
+    [GLYPH_HEAD_UP] = { L"^", COLOR_SNAKE },
+    [GLYPH_HEAD_DOWN] = { L"v", COLOR_SNAKE },
+    [GLYPH_HEAD_LEFT] = { L"<", COLOR_SNAKE },
+    [GLYPH_HEAD_RIGHT] = { L">", COLOR_SNAKE },
+    [GLYPH_HEAD_OTHER] = { L"@", COLOR_SNAKE },
+    [GLYPH_BODY_VERTICAL] = { L"|", COLOR_SNAKE },
+    [GLYPH_BODY_HORIZONTAL] = { L"-", COLOR_SNAKE },
+    [GLYPH_BODY_UP_LEFT] = { L"+", COLOR_SNAKE },
+    [GLYPH_BODY_UP_RIGHT] = { L"+", COLOR_SNAKE },
+    [GLYPH_BODY_DOWN_LEFT] = { L"+", COLOR_SNAKE },
+    [GLYPH_BODY_DOWN_RIGHT] = { L"+", COLOR_SNAKE },
+    [GLYPH_TAIL_UP] = { L":", COLOR_SNAKE },
+    [GLYPH_TAIL_DOWN] = { L":", COLOR_SNAKE },
+    [GLYPH_TAIL_LEFT] = { L"~", COLOR_SNAKE },
+    [GLYPH_TAIL_RIGHT] = { L"~", COLOR_SNAKE },
+  },
+};
+static const struct GlyphStyle *glyph_styles = glyph_themes[THEME_UNICODE];
+
+// Val: glyph_styles as ready-to-draw cells, color included (see glyph_cells_init).
+static cchar_t glyph_cells[GLYPH_COUNT];
+
+// Val: Fast-forward for rendered playback, as a multiple of TICKS_PER_SECOND.
+static int replay_speed = 1;
+
+// Val: Pit size was given (-s), so it doesn't follow the terminal.
+static int board_given = FALSE;
+
+// Val: Controller playing instead of the keyboard (-i), and its state.
+static const struct Controller *player_bot = NULL;
+static struct Bot *player_bot_state = NULL;
+
+// Val: Where S saves a snapshot and quits (-S; S does nothing without it),
+// and whether S was pressed.
+static const char *snapshot_path = NULL;
+static int snapshot_requested = FALSE;
+
+// Val: Print render and tick stats on exit (-v). Byte counts come from
+// /proc/self/io, which costs a syscall per frame, so only when asked for.
+static int verbose = FALSE;
+static int proc_io_fd = -1;
+
+// Val: This game's metrics since the last flush to the page (-M).
+static uint64_t player_tally[METRIC_COUNT];
+
+// Adam: Draw pit.
+void draw_border(struct View *view, struct GameState *game);
+
+// Adam: Main game loop.
+// Val: Or carry on with a restored one (resumed). Returns FALSE if out of memory.
+int run_game(struct View *view, struct GameState *game, const char *record_path, int resumed);
+
+// Val: Draw what a simulation step changed.
+void render_tick(struct View *view, struct GameState *game, struct TickEvents *events);
+
+// Val: Put a frame's cells on screen with a single terminal update.
+void flush_frame(struct View *view, struct Frame *frame);
+
+// Val: Draw a pit cell, if the camera sees it.
+void view_put(struct View *view, struct Coord pos, int glyph);
+
+// Val: Fit the camera to the screen and keep the first snake's head well
+// inside it. Returns TRUE if it moved (then everything has to be redrawn).
+int aim_camera(struct View *view, struct GameState *game);
+
+// Val: Draw everything from scratch: border, HUD and what the camera sees.
+void repaint_view(struct View *view, struct GameState *game);
+
+// Val: Build glyph_cells from the theme, once colors are set up.
+void glyph_cells_init();
+
+#ifdef SNAKE_PROFILE
+// Val: Value at quantile q (0-1), to within a bucket.
+long long histogram_quantile(struct Histogram *histogram, double q);
+
+// Val: Print p50/p99/max per phase.
+void profile_report(FILE *out);
+
+// Val: Show or hide the profiler overlay.
+void profile_toggle(struct View *view);
+
+// Val: Redraw the overlay with the latest numbers (if shown).
+void profile_overlay(struct View *view);
+#endif
+
+// Val: Lay out HUD fields for the current screen and draw their labels.
+void hud_init(struct View *view, struct GameState *game);
+
+// Val: Show a new value in a HUD field (only changed characters are written).
+void hud_set(struct View *view, int field, long value);
+
+// Val: Bytes this process has written so far (-1 if unknown).
+long long bytes_written();
+
+// Val: Read pending keys into the turn queue.
+void read_input(struct View *view, struct GameState *game);
+
+// Val: Terminal was resized: fit the pit to it (unless a replay or -s fixes
+// its size) and redraw everything once.
+void resize_view(struct View *view, struct GameState *game);
+
+// Val: Print game finish status.
+void print_finish(struct View *view, int end);
+
+// Adam: Debug/extra feedback.
+void feedback(struct View *view, char *content);
+
+// Adam: Main method.
+int main(int argc, char *argv[]) {
+  // Val: The game and the view it's shown in.
+  struct GameState state = { 0 };
+  struct GameState *game = &state;
+  struct View screen = { 0 };
+  struct View *view = &screen;
+
+  // Val: Command line options.
+  int opt;
+  char *record_path = NULL;
+  char *play_path = NULL;
+  char *resume_path = NULL;
+  while ((opt = getopt(argc, argv, "aevr:p:x:s:L:d:i:S:R:M:")) != -1) {
+    switch (opt) {
+      case 'a':
+        glyph_styles = glyph_themes[THEME_ASCII];
+        break;
+      case 'e':
+        event_driven = TRUE;
+        break;
+      case 'v':
+        verbose = TRUE;
+        break;
+      case 'r':
+        record_path = optarg;
+        break;
+      case 'p':
+        play_path = optarg;
+        break;
+      case 's':
+        if (!parse_board(optarg, &game->pit_lines, &game->pit_cols)) {
+          goto usage;
+        }
+        board_given = TRUE;
+        break;
+      case 'L':
+        game->win_len = atoi(optarg);
+        if (game->win_len < 4) {
+          goto usage;
+        }
+        break;
+      case 'd':
+        if (!parse_speed(optarg, &game->speed)) {
+          goto usage;
+        }
+        break;
+      case 'i':
+        player_bot = find_controller(optarg);
+        if (player_bot == NULL) {
+          goto usage;
+        }
+        break;
+      case 'S':
+        snapshot_path = optarg;
+        break;
+      case 'R':
+        resume_path = optarg;
+        break;
+      case 'M':
+        if (!metrics_open(optarg)) {
+          fprintf(stderr, "Can't create metrics page %s.\n", optarg);
+          return 1;
+        }
+        break;
+      case 'x':
+        replay_speed = atoi(optarg);
+        if (replay_speed >= 1) {
+          break;
+        }
+        // Fall through.
+      default:
+      usage:
+        fprintf(stderr, "Usage: %s [-a] [-e] [-v] [-s COLSxLINES] [-L win_len] [-d speed] [-i random|path] [-S snapshot] [-R snapshot]"
+            " [-M metrics] [-r replay | -p replay [-x speed]]\n", argv[0]);
+        fprintf(stderr, "  -a  ASCII glyphs, for terminals without box drawing or braille\n");
+        fprintf(stderr, "  -e  event-driven loop: sleep until a key or the next move is due\n");
+        fprintf(stderr, "  -v  print render and tick stats on exit\n");
+        fprintf(stderr, "  -s  pit size, if not the screen (bigger pits scroll to follow the head)\n");
+        fprintf(stderr, "  -L  winning length, if not half the pit's perimeter\n");
+        fprintf(stderr, "  -d  speed: classic, smooth, easy, hard, or SLOW:FAST ticks per move\n");
+        fprintf(stderr, "  -i  let a bot play (W and L still work)\n");
+        fprintf(stderr, "  -r  record this game to a replay file\n");
+        fprintf(stderr, "  -p  play back a replay file\n");
+        fprintf(stderr, "  -x  playback speed, as a multiple of normal\n");
+        fprintf(stderr, "  -S  S saves the game to this snapshot file and quits\n");
+        fprintf(stderr, "  -R  resume the game in a snapshot file\n");
+        fprintf(stderr, "  -M  publish metrics to this file (e.g. in /dev/shm)\n");
+        return 1;
+    }
+  }
+
+  // Val: Snapshots don't carry a replay, so they can't be part of one.
+  if ((snapshot_path != NULL || resume_path != NULL) && (record_path != NULL || play_path != NULL)) {
+    fprintf(stderr, "Snapshots (-S, -R) don't go with replays (-r, -p).\n");
+    return 1;
+  }
+  if (resume_path != NULL) {
+    if (!snapshot_read(game, resume_path)) {
+      fprintf(stderr, "Can't resume snapshot %s.\n", resume_path);
+      return 1;
+    }
+    // Its pit is the size it was saved at.
+    board_given = TRUE;
+  }
+
+  if (play_path != NULL && !replay_load(game, play_path)) {
+    fprintf(stderr, "Can't read replay %s.\n", play_path);
+    return 1;
+  }
+  if (player_bot != NULL) {
+    player_bot_state = calloc(1, sizeof(struct Bot));
+    if (player_bot_state == NULL) {
+      fprintf(stderr, "Out of memory.\n");
+      return 1;
+    }
+  }
+
+  // UTF-8 character usage via http://dillingers.com/blog/2014/08/10/ncursesw-and-unicode/.
+  // Set locale (so as to use UTF-8 characters).
+  setlocale(LC_ALL, "en_US.UTF-8");
+
+  if (verbose || metrics != NULL) {
+    proc_io_fd = open("/proc/self/io", O_RDONLY);
+  }
+
+  // Set up screen.
+  view->win = initscr();
+  curs_set(FALSE);
+  noecho();
+
+  // Set up colors.
+  use_default_colors();
+  start_color();
+
+  init_pair(COLOR_SNAKE, COLOR_BLACK, COLOR_GREEN);
+  init_pair(COLOR_TROPHY, COLOR_BLACK, COLOR_YELLOW);
+  glyph_cells_init();
+
+  // Val: Set up for game input.
+  nodelay(view->win, TRUE);
+  keypad(view->win, TRUE);
+
+  // Val: Pit is the whole screen, unless a replay or -s says otherwise
+  // (the camera follows the head around pits bigger than the screen).
+  if (game->replay.mode != REPLAY_PLAY && resume_path == NULL) {
+    if (!board_given) {
+      game->pit_lines = LINES;
+      game->pit_cols = COLS;
+    }
+    game->seed = new_game_seed();
+  }
+
+  if (!run_game(view, game, record_path, resume_path != NULL)) {
+    endwin();
+    fprintf(stderr, "Out of memory.\n");
+    return 1;
+  }
+
+  // Val: Clean up for normal input post-game.
+  // Val: Counting the keys that never got read.
+  while (wgetch(view->win) != ERR) {
+    ++player_tally[METRIC_INPUTS_DROPPED];
+  }
+  metrics_flush(player_tally);
+  nodelay(view->win, FALSE);
+  flushinp();
+
+  // Pause to display screen at the end.
+  int pressed;
+  while ((pressed = wgetch(view->win)) == KEY_UP || pressed == KEY_DOWN || pressed == KEY_LEFT || pressed == KEY_RIGHT) {
+    // Require a non-arrow key to quit (so you can't accidentally skip the end).
+  }
+
+  // Clean up after ourselves.
+  free_game(game);
+  endwin();
+
+#ifdef SNAKE_PROFILE
+  profile_report(stdout);
+#endif
+
+  if (verbose) {
+    printf("frames: %lld\n", render_stats.frames);
+    printf("bytes: %lld (%.1f per frame, max %lld)\n", render_stats.bytes,
+        render_stats.frames ? (double) render_stats.bytes / render_stats.frames : 0.0, render_stats.bytes_max);
+    printf("ticks: %lld (overruns %lld, resyncs %lld)\n", tick_clock.ticks, tick_clock.overruns, tick_clock.resyncs);
+    printf("tick jitter: %.3f ms avg, %.3f ms max\n",
+        tick_clock.ticks ? tick_clock.jitter_sum_ns / 1e6 / tick_clock.ticks : 0.0, tick_clock.jitter_max_ns / 1e6);
+  }
+
+  return 0;
+}
+#else
+// Val: Batch of games split across worker threads. Workers claim chunks of
+// game numbers from batch_next and keep their own tallies, merged at the end.
+#define BATCH_CHUNK 16
+#define BATCH_THREADS_MAX 256
+static long long batch_games = 1000;
+static long long batch_max_moves = 100000;
+static unsigned long long batch_seed = 0;
+static int batch_lines = 24;
+static int batch_cols = 80;
+static int batch_snakes = 1;
+static int batch_win_len = 0;
+static const struct Controller *batch_controller = NULL;
+static struct SpeedCurve batch_speed = { 0, 0, 0 };
+static atomic_llong batch_next;
+
+// Val: How games ended: the feedback message, or none for a win by length.
+#define END_WON 0
+#define END_TIMEOUT 6
+#define END_CAUSES 7
+static const char *end_causes[END_CAUSES] = {
+  "won",
+  "You cheated!",
+  "You can't go backwards!",
+  "You ran into the edge of the pit!",
+  "You hit yourself!",
+  "You ran into another snake!",
+  "timed out",
+};
+
+// Val: One worker's results. Aligned so workers never share a cache line.
+struct BatchWorker {
+  _Alignas(64) pthread_t thread;
+  long long games;
+  long long moves;
+  long long length_sum;
+  int length_max;
+  long long ends[END_CAUSES];
+  int failed;      // Ran out of memory.
+};
+
+// Val: Worker thread: run claimed games until the batch runs out.
+void *batch_worker(void *arg);
+
+// Val: Re-simulate a loaded replay at full speed and report how it ended.
+int headless_replay(struct GameState *game);
+
+// Val: Play a game (a new one, or the one restored from a snapshot if
+// resumed) with the bot for up to batch_max_moves moves, then save a
+// snapshot of it if save_path is set. Returns non-zero on error.
+int headless_snapshot(struct GameState *game, int resumed, const char *save_path);
+
+// Val: Server mode (-l port): many players in one process, each on a plain
+// terminal over TCP (telnet, or nc in a raw tty). One timerfd ticks every
+// session at TICKS_PER_SECOND, and a timer wheel files each session under the
+// tick where its game next has something to do, so waiting sessions cost nothing.
+// Output is the same cell updates draw_snake produces, as ANSI escapes.
+#define WHEEL_SLOTS 64 // More than TICKS_PER_MOVE_MAX: every session is due within a lap.
+#define SESSION_OUT_SIZE 2048
+#define SERVER_PIT_LINES 20
+#define SERVER_PIT_COLS 40
+#define SERVER_REPORT_TICKS (TICKS_PER_SECOND * 10)
+
+// Val: Spectator feed (-w port): a spectator connects, sends a game number
+// and a newline, then receives that game as binary records:
+//   0..GLYPH_COUNT-1  cell: varint r * cols + c now shows this glyph
+//   FEED_KEYFRAME     u16 lines, u16 cols (little-endian): blank the board,
+//                     the records up to the next delta redraw all of it
+//   FEED_LENGTH       varint length, varint winning length
+//   FEED_MESSAGE      u8 len, then the feedback text
+//   FEED_END          i8 game state, then the connection closes
+// Each tick builds one chunk per watched game, and every spectator's queue
+// points at that same chunk until it has been sent to all of them.
+// A spectator whose queue fills up loses its backlog and skips ahead to
+// the next keyframe.
+#define FEED_QUEUE_MAX 64
+#define FEED_KEYFRAME_TICKS (TICKS_PER_SECOND * 5)
+#define FEED_REQUEST_MAX 16
+enum FeedRecord {
+  FEED_KEYFRAME = 0x80,
+  FEED_LENGTH,
+  FEED_MESSAGE,
+  FEED_END,
+};
+
+// Val: Records shared by every spectator they were sent to.
+struct FeedChunk {
+  int refs;
+  int keyframe;
+  int len;
+  int size;
+  unsigned char data[];
+};
+
+// Val: What an epoll event belongs to, for connections.
+enum ConnKind {
+  CONN_PLAYER,
+  CONN_SPECTATOR,
+};
+
+// Val: Input parser states: plain keys, arrow escapes, telnet commands.
+enum InputState {
+  INPUT_KEY,
+  INPUT_ESC,      // Got ESC.
+  INPUT_CSI,      // Got ESC [ (or ESC O).
+  INPUT_IAC,      // Got telnet IAC.
+  INPUT_IAC_OPT,  // Got IAC WILL/WONT/DO/DONT, option byte next.
+  INPUT_SB,       // Inside a telnet subnegotiation.
+  INPUT_SB_IAC,   // Got IAC inside a subnegotiation.
+};
+
+// Val: One connected player.
+struct Session {
+  int kind;             // CONN_PLAYER.
+  int fd;
+  int id;               // Game number spectators ask for.
+  int closing;          // Game over: close once the output is sent.
+  int closed;           // Closed: ignore its events still in this batch.
+  int writing;          // Waiting on EPOLLOUT for a slow client.
+  int input_state;
+  long long last_tick;  // Server tick the game was last advanced to.
+  struct Session *wheel_next;
+  struct Session **wheel_prev; // Whatever points at us (NULL if not on the wheel).
+  struct Session *all_next;    // Every session, for finding one by id.
+  struct Session **all_prev;
+  struct Session *closed_next; // Closed this batch, for giving the slot back after it.
+  struct Spectator *spectators;
+  long long keyframe_tick;     // Server tick of the last keyframe sent to spectators.
+  struct GameState game;
+  int out_len;
+  int out_size;
+  char *out;            // In the slot, before the game block.
+};
+
+// Val: One connected spectator.
+struct Spectator {
+  int kind;             // CONN_SPECTATOR.
+  int fd;
+  int writing;          // Waiting on EPOLLOUT.
+  int closing;          // Game over: close once the queue is sent.
+  int closed;           // Closed: ignore its events still in this batch.
+  int resync;           // Fell behind: drop chunks until a keyframe.
+  struct Session *session; // Game watched (NULL until asked for, and after it ends).
+  struct Spectator *next;
+  struct Spectator **prev;
+  struct Spectator *closed_next; // Closed this batch, for giving the slot back after it.
+  int request_len;
+  char request[FEED_REQUEST_MAX];
+  // Chunks to send, oldest first; sent bytes of the oldest one.
+  int queue_head;
+  int queue_len;
+  int sent;
+  struct FeedChunk *queue[FEED_QUEUE_MAX];
+};
+
+// Val: Fixed-size slots carved out of the server's arena. Freed slots are
+// handed out again first, then ones never used, in order, so the arena is
+// only touched (and resident) as far as the most ever in use at once.
+struct Pool {
+  unsigned char *base;
+  size_t slot_size;
+  int slots;
+  int used;        // Slots handed out at least once.
+  void *free;      // Freed slots, each holding the next one's address.
+};
+
+// Val: Server memory (-c sessions): sessions with their game blocks,
+// spectators (as many as sessions) and feed chunks (FEED_CHUNKS_PER_SPECTATOR
+// per spectator, all one size) come out of a single allocation made at
+// startup. Taking a session or spectator past the cap refuses the
+// connection; running out of chunks makes spectators resync, as if they'd
+// fallen behind.
+#define SERVER_SESSIONS_DEFAULT 4096
+#define FEED_CHUNKS_PER_SPECTATOR 8
+#define POOL_ALIGN 64
+
+// Val: Everything the server loop owns.
+struct Server {
+  int epoll_fd;
+  int listen_fd;
+  int watch_fd;         // Spectator listening socket (-1 if none).
+  int timer_fd;
+  int accepting;        // Listening socket is in the epoll set.
+  int pit_lines;
+  int pit_cols;
+  int win_len;
+  long long tick;
+  int sessions;
+  int spectators;
+  int next_id;
+  struct Session *all;
+  struct Session *closed_sessions; // Closed during this event batch, slots not yet given back.
+  struct Spectator *closed_spectators;
+  struct Session *wheel[WHEEL_SLOTS];
+  void *arena;
+  struct Pool session_pool;   // Session, then its game block.
+  struct Pool spectator_pool;
+  struct Pool chunk_pool;
+  int chunk_size;            // Data bytes in each pooled chunk.
+  int out_size;              // Output buffer bytes in each session slot.
+  // Stats since the last report.
+  long long ticks;
+  long long feed_moves;  // Moves sent to spectators, and the delta bytes for them
+  long long feed_bytes;  // (once per game however many are watching).
+  long long overruns;   // Ticks the timer fired without us getting to run them.
+  long long work_ns;
+  long long work_max_ns;
+  uint64_t tally[METRIC_COUNT]; // Metrics since the last tick's flush (-M).
+};
+static struct Server server;
+
+// Val: How glyphs look on a client's terminal (UTF-8, same as glyph_themes).
+static const char *const ansi_themes[THEMES][GLYPH_COUNT] = {
+  [THEME_UNICODE] = {
+    [GLYPH_BLANK] = " ",
+    [GLYPH_TROPHY] = "1", "2", "3", "4", "5", "6", "7", "8", "9",
+    [GLYPH_HEAD_UP] = "⠉",
+    [GLYPH_HEAD_DOWN] = "⣀",
+    [GLYPH_HEAD_LEFT] = "⠆",
+    [GLYPH_HEAD_RIGHT] = "⠰",
+    [GLYPH_HEAD_OTHER] = "@",
+    [GLYPH_BODY_VERTICAL] = "║",
+    [GLYPH_BODY_HORIZONTAL] = "═",
+    [GLYPH_BODY_UP_LEFT] = "╝",
+    [GLYPH_BODY_UP_RIGHT] = "╚",
+    [GLYPH_BODY_DOWN_LEFT] = "╗",
+    [GLYPH_BODY_DOWN_RIGHT] = "╔",
+    [GLYPH_TAIL_UP] = "╜",
+    [GLYPH_TAIL_DOWN] = "╓",
+    [GLYPH_TAIL_LEFT] = "╕",
+    [GLYPH_TAIL_RIGHT] = "╘",
+  },
+  [THEME_ASCII] = {
+    [GLYPH_BLANK] = " ",
+    [GLYPH_TROPHY] = "1", "2", "3", "4", "5", "6", "7", "8", "9",
+    [GLYPH_HEAD_UP] = "^",
+    [GLYPH_HEAD_DOWN] = "v",
+    [GLYPH_HEAD_LEFT] = "<",
+    [GLYPH_HEAD_RIGHT] = ">",
+    [GLYPH_HEAD_OTHER] = "@",
+    [GLYPH_BODY_VERTICAL] = "|",
+    [GLYPH_BODY_HORIZONTAL] = "-",
+    [GLYPH_BODY_UP_LEFT] = "+",
+    [GLYPH_BODY_UP_RIGHT] = "+",
+    [GLYPH_BODY_DOWN_LEFT] = "+",
+    [GLYPH_BODY_DOWN_RIGHT] = "+",
+    [GLYPH_TAIL_UP] = ":",
+    [GLYPH_TAIL_DOWN] = ":",
+    [GLYPH_TAIL_LEFT] = "~",
+    [GLYPH_TAIL_RIGHT] = "~",
+  },
+};
+static const char *const *ansi_glyphs = ansi_themes[THEME_UNICODE];
+static const char ansi_glyph_colors[GLYPH_COUNT] = {
+  [GLYPH_TROPHY] = COLOR_TROPHY, COLOR_TROPHY, COLOR_TROPHY, COLOR_TROPHY, COLOR_TROPHY,
+  COLOR_TROPHY, COLOR_TROPHY, COLOR_TROPHY, COLOR_TROPHY,
+  [GLYPH_HEAD_UP] = COLOR_SNAKE, COLOR_SNAKE, COLOR_SNAKE, COLOR_SNAKE, COLOR_SNAKE,
+  COLOR_SNAKE, COLOR_SNAKE, COLOR_SNAKE, COLOR_SNAKE, COLOR_SNAKE, COLOR_SNAKE,
+  COLOR_SNAKE, COLOR_SNAKE, COLOR_SNAKE, COLOR_SNAKE,
+};
+// Val: SGR sequences for COLOR_DEFAULT, COLOR_SNAKE and COLOR_TROPHY.
+static const char *const ansi_colors[] = { "\033[0m", "\033[0;30;42m", "\033[0;30;43m" };
+
+// Val: Run the server until killed. Returns non-zero if it can't start.
+// Val: Spectators connect to watch_port (no feed if 0).
+// Val: At most max_sessions players, and as many spectators.
+int run_server(int port, int watch_port, int pit_lines, int pit_cols, int win_len, int max_sessions);
+
+// Val: Carve a pool of slots slot_size bytes each (rounded up to POOL_ALIGN)
+// from *arena, moving it past them.
+void pool_init(struct Pool *pool, unsigned char **arena, size_t slot_size, int slots);
+
+// Val: Take a slot (NULL if all are in use). Its contents are left as they were.
+void *pool_get(struct Pool *pool);
+
+// Val: Give a slot back.
+void pool_put(struct Pool *pool, void *slot);
+
+// Val: Open a non-blocking listening socket in the epoll set. Returns -1 on error.
+int server_listen(int port, void *ptr);
+
+// Val: Accept every pending connection.
+void server_accept();
+
+// Val: Start or stop accepting connections (stopped while out of descriptors).
+void server_set_accepting(int accepting);
+
+// Val: Give back the slots of connections closed during an event batch.
+void server_release();
+
+// Val: Run one server tick: advance the sessions due now.
+void server_tick();
+
+// Val: Put a session on the wheel, due in ticks ticks.
+void session_schedule(struct Session *session, int ticks);
+
+// Val: Take a session off the wheel.
+void session_unschedule(struct Session *session);
+
+// Val: Read and apply whatever the client sent. Returns FALSE if it hung up.
+int session_read(struct Session *session);
+
+// Val: Queue output for the client (drops the client if its buffer overflows).
+void session_printf(struct Session *session, const char *format, ...);
+
+// Val: Send buffered output. Returns FALSE if the session was closed.
+int session_flush(struct Session *session);
+
+// Val: Close the connection. The slot goes back in server_release, once
+// the event batch that might still mention it is done.
+void session_close(struct Session *session);
+
+// Val: Draw what a tick changed, like render_tick but into the output buffer.
+void session_render(struct Session *session, struct TickEvents *events);
+
+// Val: Accept every pending spectator.
+void spectator_accept();
+
+// Val: Read the game number (or notice a hang-up). Returns FALSE if it hung up.
+int spectator_read(struct Spectator *spectator);
+
+// Val: Send queued chunks. Returns FALSE if the spectator was closed.
+int spectator_flush(struct Spectator *spectator);
+
+// Val: Close the connection and drop the spectator's queued chunks. The
+// slot goes back in server_release, like a session's.
+void spectator_close(struct Spectator *spectator);
+
+// Val: New chunk with room for size bytes, holding one reference (NULL if
+// the pool is out of chunks, or they're smaller than that).
+struct FeedChunk *feed_chunk_new(int size);
+
+// Val: Drop a reference, returning the chunk to the pool with the last one.
+void feed_chunk_release(struct FeedChunk *chunk);
+
+// Val: Append a byte (the size given to feed_chunk_new must cover it).
+void feed_put(struct FeedChunk *chunk, int byte);
+
+// Val: Append an unsigned LEB128 varint.
+void feed_put_varint(struct FeedChunk *chunk, unsigned long long value);
+
+// Val: Append a cell record.
+void feed_put_cell(struct FeedChunk *chunk, struct GameState *game, struct Coord pos, int glyph);
+
+// Val: Whole board as a keyframe chunk.
+struct FeedChunk *feed_keyframe(struct Session *session);
+
+// Val: Queue a chunk for every spectator of a session, then drop the caller's reference.
+void feed_publish(struct Session *session, struct FeedChunk *chunk);
+
+// Val: Queue a chunk for one spectator, to go out on its next flush (NULL: it missed one).
+void feed_queue(struct Spectator *spectator, struct FeedChunk *chunk);
+
+// Val: Tell a session's spectators the game is over (state as sim_tick returns it) and let them go.
+void feed_end(struct Session *session, int state);
+
+// Val: Benchmark (-b): the per-move hot path on boards from 80x24 to 1000x1000
+// and a few snake lengths each. The snake follows a Hamiltonian cycle of the
+// pit, so it never dies and every move is a real one. Prints one
+// tab-separated line per case, for diffing runs:
+//   move_ns     update_next_head + advance_snake
+//   eat_ns      award_trophy on a trophy right at the head
+//   spawn_ns    generate_trophy with spawn_free cells left in the pit
+//   frame_bytes ANSI bytes session_render sends per move
+//   fork_ns     fork_game into a game of the same shape
+#define BENCH_MOVES 1000000
+#define BENCH_EATS 1000000
+#define BENCH_SPAWNS 1000000
+#define BENCH_FRAMES 10000
+#define BENCH_FREE_PERCENT 1
+#define BENCH_FORK_BYTES 1000000000LL
+static const struct Coord bench_boards[] = { { 24, 80 }, { 60, 200 }, { 200, 500 }, { 1000, 1000 } };
+#define BENCH_BOARDS (sizeof(bench_boards) / sizeof(bench_boards[0]))
+
+// Val: Run every case (or just the given board). Returns non-zero on error.
+int run_bench(int lines, int cols);
+
+// Val: One board and snake length.
+int bench_case(int lines, int cols, int length);
+
+// Val: Headless main: run games back-to-back on all cores as fast as possible and report throughput.
+int main(int argc, char *argv[]) {
+  long threads = sysconf(_SC_NPROCESSORS_ONLN);
+  struct GameState replay_game = { 0 };
+  int port = 0;
+  int watch_port = 0;
+  int bench = FALSE;
+  int pit_given = FALSE;
+  int max_sessions = SERVER_SESSIONS_DEFAULT;
+  batch_controller = find_controller("random");
+  char *save_path = NULL;
+  int resumed = FALSE;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "g:m:s:t:n:p:l:w:L:d:c:i:S:R:M:Q:ab")) != -1) {
+    switch (opt) {
+      case 'p':
+        if (!replay_load(&replay_game, optarg)) {
+          fprintf(stderr, "Can't read replay %s.\n", optarg);
+          return 1;
+        }
+        break;
+      case 'g':
+        batch_games = atoll(optarg);
+        break;
+      case 'm':
+        batch_max_moves = atoll(optarg);
+        break;
+      case 't':
+        threads = atol(optarg);
+        if (threads >= 1) {
+          break;
+        }
+        goto usage;
+      case 'n':
+        batch_snakes = atoi(optarg);
+        if (batch_snakes >= 1 && batch_snakes <= SNAKES_MAX) {
+          break;
+        }
+        goto usage;
+      case 'l':
+        port = atoi(optarg);
+        if (port > 0 && port < 65536) {
+          break;
+        }
+        goto usage;
+      case 'a':
+        ansi_glyphs = ansi_themes[THEME_ASCII];
+        break;
+      case 'b':
+        bench = TRUE;
+        break;
+      case 'w':
+        watch_port = atoi(optarg);
+        if (watch_port > 0 && watch_port < 65536) {
+          break;
+        }
+        goto usage;
+      case 'c':
+        max_sessions = atoi(optarg);
+        if (max_sessions >= 1) {
+          break;
+        }
+        goto usage;
+      case 'L':
+        batch_win_len = atoi(optarg);
+        if (batch_win_len >= 4) {
+          break;
+        }
+        goto usage;
+      case 'd':
+        if (parse_speed(optarg, &batch_speed)) {
+          break;
+        }
+        goto usage;
+      case 'i':
+        batch_controller = find_controller(optarg);
+        if (batch_controller != NULL) {
+          break;
+        }
+        goto usage;
+      case 'S':
+        save_path = optarg;
+        break;
+      case 'R':
+        if (!snapshot_read(&replay_game, optarg)) {
+          fprintf(stderr, "Can't resume snapshot %s.\n", optarg);
+          return 1;
+        }
+        resumed = TRUE;
+        break;
+      case 'M':
+        if (!metrics_open(optarg)) {
+          fprintf(stderr, "Can't create metrics page %s.\n", optarg);
+          return 1;
+        }
+        break;
+      case 'Q':
+        if (!metrics_print(optarg, stdout)) {
+          fprintf(stderr, "No metrics page at %s.\n", optarg);
+          return 1;
+        }
+        return 0;
+      case 's':
+        if (parse_board(optarg, &batch_lines, &batch_cols)) {
+          pit_given = TRUE;
+          break;
+        }
+        // Fall through.
+      default:
+      usage:
+        fprintf(stderr, "Usage: %s [-g games] [-m max_moves] [-s COLSxLINES] [-L win_len] [-d speed] [-n snakes] [-t threads] [-i random|path]\n", argv[0]);
+        fprintf(stderr, "       %s -p replay\n", argv[0]);
+        fprintf(stderr, "       %s [-R snapshot] [-S snapshot] [-m max_moves] [-s COLSxLINES] [-L win_len] [-d speed] [-n snakes] [-i random|path]\n", argv[0]);
+        fprintf(stderr, "       %s -b [-s COLSxLINES]\n", argv[0]);
+        fprintf(stderr, "       %s -l port [-w port] [-c sessions] [-s COLSxLINES] [-L win_len] [-a]\n", argv[0]);
+        fprintf(stderr, "       %s -Q metrics\n", argv[0]);
+        fprintf(stderr, "Games and the server publish metrics to a file with -M metrics; -Q prints them.\n");
+        return 1;
+    }
+  }
+
+  if (bench) {
+    return run_bench(pit_given ? batch_lines : 0, pit_given ? batch_cols : 0);
+  }
+
+  if (port > 0) {
+    return run_server(port, watch_port, pit_given ? batch_lines : SERVER_PIT_LINES,
+        pit_given ? batch_cols : SERVER_PIT_COLS, batch_win_len, max_sessions);
+  }
+
+  if (replay_game.replay.mode == REPLAY_PLAY) {
+    int result = headless_replay(&replay_game);
+    free_game(&replay_game);
+    return result;
+  }
+
+  if (resumed || save_path != NULL) {
+    int result = headless_snapshot(&replay_game, resumed, save_path);
+    free_game(&replay_game);
+    return result;
+  }
+  batch_seed = new_game_seed();
+  if (threads > BATCH_THREADS_MAX) {
+    threads = BATCH_THREADS_MAX;
+  }
+  if (threads > batch_games && batch_games > 0) {
+    threads = batch_games;
+  }
+
+  // calloc only promises max_align_t, less than the cache line workers are aligned to.
+  // (The struct's size is a multiple of its alignment, as aligned_alloc wants.)
+  struct BatchWorker *workers = aligned_alloc(_Alignof(struct BatchWorker), threads * sizeof(struct BatchWorker));
+  if (workers == NULL) {
+    fprintf(stderr, "Out of memory.\n");
+    return 1;
+  }
+  memset(workers, 0, threads * sizeof(struct BatchWorker));
+
+  struct timespec start;
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  atomic_init(&batch_next, 0);
+  long started = 0;
+  for (; started < threads; ++started) {
+    if (pthread_create(&workers[started].thread, NULL, batch_worker, &workers[started]) != 0) {
+      break;
+    }
+  }
+  // Couldn't start any thread: run the batch here instead.
+  if (started == 0) {
+    batch_worker(&workers[0]);
+    threads = 1;
+  }
+
+  struct BatchWorker total = { 0 };
+  for (long i = 0; i < threads; ++i) {
+    if (i < started) {
+      pthread_join(workers[i].thread, NULL);
+    }
+    total.games += workers[i].games;
+    total.moves += workers[i].moves;
+    total.length_sum += workers[i].length_sum;
+    if (workers[i].length_max > total.length_max) {
+      total.length_max = workers[i].length_max;
+    }
+    for (int e = 0; e < END_CAUSES; ++e) {
+      total.ends[e] += workers[i].ends[e];
+    }
+    total.failed |= workers[i].failed;
+  }
+  free(workers);
+  if (total.failed) {
+    fprintf(stderr, "Out of memory.\n");
+    return 1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+  long long losses = total.games - total.ends[END_WON] - total.ends[END_TIMEOUT];
+  printf("games: %lld (win %lld, loss %lld, timeout %lld)\n", total.games,
+      total.ends[END_WON], losses, total.ends[END_TIMEOUT]);
+  for (int e = 0; e < END_CAUSES; ++e) {
+    if (total.ends[e] > 0) {
+      printf("  %s: %lld\n", end_causes[e], total.ends[e]);
+    }
+  }
+  printf("length: %.1f avg, %d max\n", total.games ? (double) total.length_sum / total.games : 0.0, total.length_max);
+  printf("moves: %lld\n", total.moves);
+  printf("threads: %ld\n", threads);
+  printf("time: %.3f s\n", secs);
+  printf("games/sec: %.0f\n", total.games / secs);
+  printf("moves/sec: %.0f\n", total.moves / secs);
+
+  return 0;
+}
+
+// Val: Worker thread: run claimed games until the batch runs out.
+void *batch_worker(void *arg) {
+  struct BatchWorker *worker = arg;
+
+  // Each worker plays its games in its own state; the bot's random state is
+  // reseeded with each game, so results don't depend on how games were spread.
+  struct GameState state = { 0 };
+  struct GameState *game = &state;
+  struct Bot *bot = calloc(1, sizeof(struct Bot));
+  if (bot == NULL) {
+    worker->failed = TRUE;
+    return NULL;
+  }
+  uint64_t tally[METRIC_COUNT] = { 0 };
+  game->pit_lines = batch_lines;
+  game->pit_cols = batch_cols;
+  game->win_len = batch_win_len;
+  game->speed = batch_speed;
+
+  long long number;
+  while ((number = atomic_fetch_add_explicit(&batch_next, BATCH_CHUNK, memory_order_relaxed)) < batch_games) {
+    long long chunk_end = number + BATCH_CHUNK < batch_games ? number + BATCH_CHUNK : batch_games;
+    for (; number < chunk_end; ++number) {
+      struct TickEvents events;
+      game->seed = batch_seed + number;
+      game->snake_count = batch_snakes;
+      if (!reset_snake(game, &events)) {
+        worker->failed = TRUE;
+        free(bot);
+        return NULL;
+      }
+      rng_seed(&bot->rng, ~game->seed);
+
+      int game_state = PLAYING;
+      long long game_moves = 0;
+      int ticks = 1;
+      while (game_state == PLAYING && game_moves < batch_max_moves) {
+        poll_controller(game, batch_controller, bot, ticks);
+        game_state = sim_tick(game, ticks, &events);
+        metrics_tally(tally, &events, ticks);
+        game_moves += events.moved;
+        // Skip straight to the next tick where something happens.
+        ticks = sim_idle_ticks(game);
+      }
+      ++tally[METRIC_GAMES];
+      metrics_flush(tally);
+
+      // Val: The longest snake on the board counts for the game.
+      int length = 0;
+      for (int i = 0; i < game->snake_count; ++i) {
+        if (game->snakes[i].len > length) {
+          length = game->snakes[i].len;
+        }
+      }
+
+      // Val: Only the tick that ended the game says why. Earlier ones carry
+      // other snakes' deaths, and so can that one, ahead of a win by length.
+      int cause = END_TIMEOUT;
+      if (game_state == WIN && length >= game->snake_win_len) {
+        cause = END_WON;
+      } else if (game_state != PLAYING) {
+        for (cause = 1; cause < END_TIMEOUT && (events.message == NULL || strcmp(events.message, end_causes[cause]) != 0);
+             ++cause) {
+        }
+      }
+
+      ++worker->games;
+      ++worker->ends[cause];
+      worker->moves += game_moves;
+      worker->length_sum += length;
+      if (length > worker->length_max) {
+        worker->length_max = length;
+      }
+    }
+  }
+
+  free_game(game);
+  free(bot);
+  return NULL;
+}
+
+// Val: Re-simulate a loaded replay at full speed and report how it ended.
+int headless_replay(struct GameState *game) {
+  struct TickEvents events;
+  if (!reset_snake(game, &events)) {
+    fprintf(stderr, "Out of memory.\n");
+    return 1;
+  }
+
+  struct timespec start;
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  int game_state = PLAYING;
+  long long moves = 0;
+  long long ticks_total = 0;
+  char *message = NULL;
+  int ticks = 1;
+  while (game_state == PLAYING) {
+    game_state = sim_tick(game, ticks, &events);
+    moves += events.moved;
+    ticks_total += ticks;
+    if (events.message != NULL) {
+      message = events.message;
+    }
+    // A replay that runs past its recorded end is out of sync; stop there.
+    if (game->replay.code == REPLAY_END && game->replay.run < 0) {
+      break;
+    }
+    ticks = sim_idle_ticks(game);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+  char *result = game_state == WIN ? "win" : game_state == LOSS ? "loss" : "unfinished";
+  printf("seed: %llu\n", game->seed);
+  printf("pit: %dx%d\n", game->pit_cols, game->pit_lines);
+  printf("result: %s after %lld moves (%.1f s of play), length %d/%d\n",
+      result, moves, (double) ticks_total / TICKS_PER_SECOND, game->snakes[0].len, game->snake_win_len);
+  if (message != NULL) {
+    printf("message: %s\n", message);
+  }
+  printf("matches recording: %s\n", game_state == game->replay.final_state ? "yes" : "no");
+  printf("time: %.6f s\n", secs);
+
+  return game_state == game->replay.final_state ? 0 : 2;
+}
+
+// Val: Play a game (a new one, or the one restored from a snapshot if
+// resumed) with the bot for up to batch_max_moves moves, then save a
+// snapshot of it if save_path is set. Returns non-zero on error.
+int headless_snapshot(struct GameState *game, int resumed, const char *save_path) {
+  struct TickEvents events;
+  if (!resumed) {
+    game->pit_lines = batch_lines;
+    game->pit_cols = batch_cols;
+    game->win_len = batch_win_len;
+    game->speed = batch_speed;
+    game->snake_count = batch_snakes;
+    game->seed = new_game_seed();
+    if (!reset_snake(game, &events)) {
+      fprintf(stderr, "Out of memory.\n");
+      return 1;
+    }
+  }
+  struct Bot *bot = calloc(1, sizeof(struct Bot));
+  if (bot == NULL) {
+    return 1;
+  }
+  rng_seed(&bot->rng, ~game->seed);
+
+  // A game saved mid-tick picks up where the loop left off: the next tick
+  // where something happens.
+  int game_state = game->snakes_alive > 0 ? PLAYING : LOSS;
+  long long moves = 0;
+  char *message = NULL;
+  int ticks = resumed ? sim_idle_ticks(game) : 1;
+  uint64_t tally[METRIC_COUNT] = { 0 };
+  tally[METRIC_GAMES] = !resumed;
+  while (game_state == PLAYING && moves < batch_max_moves) {
+    poll_controller(game, batch_controller, bot, ticks);
+    game_state = sim_tick(game, ticks, &events);
+    metrics_tally(tally, &events, ticks);
+    moves += events.moved;
+    if (events.message != NULL) {
+      message = events.message;
+    }
+    ticks = sim_idle_ticks(game);
+  }
+  metrics_flush(tally);
+  free(bot);
+
+  char *result = game_state == WIN ? "win" : game_state == LOSS ? "loss" : "unfinished";
+  printf("seed: %llu\n", game->seed);
+  printf("pit: %dx%d\n", game->pit_cols, game->pit_lines);
+  printf("result: %s after %lld more moves, length %d/%d\n", result, moves, game->snakes[0].len, game->snake_win_len);
+  if (message != NULL) {
+    printf("message: %s\n", message);
+  }
+  if (save_path != NULL) {
+    if (!snapshot_write(game, save_path)) {
+      fprintf(stderr, "Can't write snapshot %s.\n", save_path);
+      return 1;
+    }
+    printf("snapshot: %s, %zu bytes\n", save_path, snapshot_size(game));
+  }
+  return 0;
+}
+
+// Val: Run the server until killed. Returns non-zero if it can't start.
+// Val: Spectators connect to watch_port (no feed if 0).
+int run_server(int port, int watch_port, int pit_lines, int pit_cols, int win_len, int max_sessions) {
+  // Sparse pits hand out chunks as snakes move, which the arena can't size.
+  if ((long long) pit_lines * pit_cols > SPARSE_CELLS) {
+    fprintf(stderr, "Server pits are at most %d cells.\n", SPARSE_CELLS);
+    return 1;
+  }
+  server.pit_lines = pit_lines;
+  server.pit_cols = pit_cols;
+  server.win_len = win_len > 0 ? win_len : pit_lines + pit_cols;
+  server.next_id = 1;
+
+  // Val: One arena for everything sessions and spectators use. Chunks are
+  // big enough for a keyframe of a full-length snake or any tick's delta.
+  int keyframe_size = 16 + (server.win_len + 1) * 6;
+  int delta_size = FRAME_CELLS_MAX * 6 + 16 + 255;
+  server.chunk_size = keyframe_size > delta_size ? keyframe_size : delta_size;
+  // Val: Output buffers hold the usual ticks plus the first frame's border:
+  // 3 bytes a box character along the top and bottom, two cursor moves and
+  // two of them a line down the sides.
+  server.out_size = (SESSION_OUT_SIZE + 6 * pit_cols + 40 * pit_lines + POOL_ALIGN - 1) / POOL_ALIGN * POOL_ALIGN;
+  size_t session_size = sizeof(struct Session) + server.out_size + game_block_size(1, server.win_len, pit_lines * pit_cols);
+  size_t chunk_slot_size = sizeof(struct FeedChunk) + server.chunk_size;
+  int max_chunks = watch_port > 0 ? max_sessions * FEED_CHUNKS_PER_SPECTATOR : 0;
+  int max_spectators = watch_port > 0 ? max_sessions : 0;
+  size_t arena_size = (session_size + POOL_ALIGN) * max_sessions + (sizeof(struct Spectator) + POOL_ALIGN) * max_spectators
+      + (chunk_slot_size + POOL_ALIGN) * max_chunks + POOL_ALIGN;
+  server.arena = malloc(arena_size);
+  if (server.arena == NULL) {
+    fprintf(stderr, "Can't allocate %zu bytes for %d sessions.\n", arena_size, max_sessions);
+    return 1;
+  }
+  unsigned char *arena = (unsigned char *) (((uintptr_t) server.arena + POOL_ALIGN - 1) & ~(uintptr_t) (POOL_ALIGN - 1));
+  pool_init(&server.session_pool, &arena, session_size, max_sessions);
+  pool_init(&server.spectator_pool, &arena, sizeof(struct Spectator), max_spectators);
+  pool_init(&server.chunk_pool, &arena, chunk_slot_size, max_chunks);
+
+  server.epoll_fd = epoll_create1(0);
+  server.listen_fd = server_listen(port, &server.listen_fd);
+  server.watch_fd = watch_port > 0 ? server_listen(watch_port, &server.watch_fd) : -1;
+  if (server.listen_fd < 0 || (watch_port > 0 && server.watch_fd < 0)) {
+    perror("listen");
+    return 1;
+  }
+  server.accepting = TRUE;
+
+  // One periodic timer for every session; a late wakeup shows up as several expirations.
+  server.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+  struct itimerspec period = { { 0, NSECS_PER_TICK }, { 0, NSECS_PER_TICK } };
+  timerfd_settime(server.timer_fd, 0, &period, NULL);
+  struct epoll_event event = { .events = EPOLLIN, .data.ptr = &server.timer_fd };
+  epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.timer_fd, &event);
+
+  fprintf(stderr, "Listening on port %d, %dx%d pit, up to %d sessions of %zu bytes (game included).\n",
+      port, pit_cols, pit_lines, max_sessions, server.session_pool.slot_size);
+  if (server.watch_fd >= 0) {
+    fprintf(stderr, "Spectators on port %d, up to %d of %zu bytes, %d feed chunks of %zu bytes.\n", watch_port,
+        max_spectators, server.spectator_pool.slot_size, max_chunks, server.chunk_pool.slot_size);
+  }
+  fprintf(stderr, "Arena: %zu KB, only resident as far as it's used.\n", arena_size / 1024);
+
+  struct epoll_event events[256];
+  while (1) {
+    int count = epoll_wait(server.epoll_fd, events, 256, -1);
+    for (int i = 0; i < count; ++i) {
+      void *ptr = events[i].data.ptr;
+      if (ptr == &server.listen_fd) {
+        server_accept();
+      } else if (ptr == &server.watch_fd) {
+        spectator_accept();
+      } else if (ptr == &server.timer_fd) {
+        uint64_t expirations = 0;
+        if (read(server.timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+          continue;
+        }
+        // Catch up on missed ticks; past a full lap every session has been due at least once.
+        if (expirations > 1) {
+          server.overruns += expirations - 1;
+          server.tally[METRIC_TICK_OVERRUNS] += expirations - 1;
+        }
+        if (expirations > WHEEL_SLOTS) {
+          server.tick += expirations - WHEEL_SLOTS;
+          expirations = WHEEL_SLOTS;
+        }
+        while (expirations-- > 0) {
+          server_tick();
+        }
+      } else if (*(int *) ptr == CONN_SPECTATOR) {
+        struct Spectator *spectator = ptr;
+        if (spectator->closed) {
+          continue;
+        }
+        if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+          if (!spectator_read(spectator)) {
+            spectator_close(spectator);
+            continue;
+          }
+        }
+        // Also sends the keyframe queued when it picked a game.
+        spectator_flush(spectator);
+      } else {
+        struct Session *session = ptr;
+        if (session->closed) {
+          continue;
+        }
+        if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+          if (!session_read(session)) {
+            session_close(session);
+            continue;
+          }
+        }
+        if (events[i].events & EPOLLOUT) {
+          session_flush(session);
+        }
+      }
+    }
+    // Closed connections' events can't come up again now.
+    server_release();
+  }
+}
+
+// Val: Carve a pool of slots slot_size bytes each (rounded up to POOL_ALIGN)
+// from *arena, moving it past them.
+void pool_init(struct Pool *pool, unsigned char **arena, size_t slot_size, int slots) {
+  pool->base = *arena;
+  pool->slot_size = (slot_size + POOL_ALIGN - 1) / POOL_ALIGN * POOL_ALIGN;
+  pool->slots = slots;
+  pool->used = 0;
+  pool->free = NULL;
+  *arena += pool->slot_size * slots;
+}
+
+// Val: Take a slot (NULL if all are in use). Its contents are left as they were.
+void *pool_get(struct Pool *pool) {
+  if (pool->free != NULL) {
+    void *slot = pool->free;
+    pool->free = *(void **) slot;
+    return slot;
+  }
+  if (pool->used < pool->slots) {
+    return pool->base + pool->slot_size * pool->used++;
+  }
+  return NULL;
+}
+
+// Val: Give a slot back.
+void pool_put(struct Pool *pool, void *slot) {
+  *(void **) slot = pool->free;
+  pool->free = slot;
+}
+
+// Val: Open a non-blocking listening socket in the epoll set. Returns -1 on error.
+int server_listen(int port, void *ptr) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  int yes = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+  struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_ANY) };
+  if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+    close(fd);
+    return -1;
+  }
+  struct epoll_event event = { .events = EPOLLIN, .data.ptr = ptr };
+  epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, fd, &event);
+  return fd;
+}
+
+// Val: Accept every pending connection.
+void server_accept() {
+  while (1) {
+    int fd = accept(server.listen_fd, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EMFILE || errno == ENFILE) {
+        // Out of descriptors: stop listening until a session closes, or we'd spin on it.
+        server_set_accepting(FALSE);
+      }
+      return;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+
+    // At the cap: turn it away.
+    struct Session *session = pool_get(&server.session_pool);
+    if (session == NULL) {
+      close(fd);
+      continue;
+    }
+    memset(session, 0, sizeof(struct Session));
+    session->fd = fd;
+    session->id = server.next_id++;
+    session->out = (char *) session + sizeof(struct Session);
+    session->out_size = server.out_size;
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = session };
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    ++server.sessions;
+    session->all_next = server.all;
+    if (server.all != NULL) {
+      server.all->all_prev = &session->all_next;
+    }
+    session->all_prev = &server.all;
+    server.all = session;
+
+    // The game block after the session and its output buffer was sized for
+    // this pit and winning length, so reset_snake has nothing to allocate.
+    struct GameState *game = &session->game;
+    game->pit_lines = server.pit_lines;
+    game->pit_cols = server.pit_cols;
+    game->win_len = server.win_len;
+    game->block = (unsigned char *) session->out + server.out_size;
+    game->snakes_size = 1;
+    game->ring_size = server.win_len;
+    game->cells_size = server.pit_lines * server.pit_cols;
+    layout_block(game);
+    game->seed = new_game_seed();
+    // (It fits, so this can't fail short of a bug: drop the player if it does.)
+    struct TickEvents events;
+    if (!reset_snake(game, &events)) {
+      session_close(session);
+      continue;
+    }
+    ++server.tally[METRIC_GAMES];
+
+    // Telnet: we echo (i.e. don't) and want keys one at a time. Then clear
+    // the screen, hide the cursor and draw the pit.
+    session_printf(session, "\377\373\001\377\373\003\033[?25l\033[0m\033[2J\033[1;1H┌");
+    for (int c = 1; c < game->pit_cols - 1; ++c) {
+      session_printf(session, "─");
+    }
+    session_printf(session, "┐\033[1;2HSnake-2.0 #%d", session->id);
+    for (int r = 2; r < game->pit_lines; ++r) {
+      session_printf(session, "\033[%d;1H│\033[%d;%dH│", r, r, game->pit_cols);
+    }
+    session_printf(session, "\033[%d;1H└", game->pit_lines);
+    for (int c = 1; c < game->pit_cols - 1; ++c) {
+      session_printf(session, "─");
+    }
+    session_printf(session, "┘\033[%d;3HWin: %d/%d", game->pit_lines, game->snakes[0].len, game->snake_win_len);
+
+    session->last_tick = server.tick;
+    session_render(session, &events);
+    session_schedule(session, 1);
+    session_flush(session);
+  }
+}
+
+// Val: Start or stop accepting connections (stopped while out of descriptors).
+void server_set_accepting(int accepting) {
+  if (accepting == server.accepting) {
+    return;
+  }
+  struct epoll_event event = { .events = EPOLLIN, .data.ptr = &server.listen_fd };
+  epoll_ctl(server.epoll_fd, accepting ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, server.listen_fd, &event);
+  if (server.watch_fd >= 0) {
+    event.data.ptr = &server.watch_fd;
+    epoll_ctl(server.epoll_fd, accepting ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, server.watch_fd, &event);
+  }
+  server.accepting = accepting;
+}
+
+// Val: Give back the slots of connections closed during an event batch.
+void server_release() {
+  while (server.closed_sessions != NULL) {
+    struct Session *session = server.closed_sessions;
+    server.closed_sessions = session->closed_next;
+    // The game block is part of the slot, ready for the next session.
+    pool_put(&server.session_pool, session);
+  }
+  while (server.closed_spectators != NULL) {
+    struct Spectator *spectator = server.closed_spectators;
+    server.closed_spectators = spectator->closed_next;
+    pool_put(&server.spectator_pool, spectator);
+  }
+}
+
+// Val: Run one server tick: advance the sessions due now.
+void server_tick() {
+  struct timespec start;
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  ++server.tick;
+  struct Session *session;
+  while ((session = server.wheel[server.tick % WHEEL_SLOTS]) != NULL) {
+    session_unschedule(session);
+
+    struct TickEvents events;
+    int state = sim_tick(&session->game, server.tick - session->last_tick, &events);
+    session->last_tick = server.tick;
+    session_render(session, &events);
+    metrics_tally(server.tally, &events, 0);
+
+    if (state != PLAYING) {
+      // Same ending as the terminal game, without the art.
+      struct GameState *game = &session->game;
+      session_printf(session, "\033[0m\033[%d;%dH%s\033[%d;1H\033[?25h\r\n", game->pit_lines / 2 + 1,
+          game->pit_cols / 2 - 3, state == WIN ? "You win!" : "You lose.", game->pit_lines + 1);
+      session->closing = TRUE;
+      feed_end(session, state);
+    } else {
+      session_schedule(session, sim_idle_ticks(&session->game));
+    }
+    session_flush(session);
+  }
+
+  ++server.tally[METRIC_TICKS];
+  metrics_flush(server.tally);
+  metrics_set(METRIC_SESSIONS, server.sessions);
+  metrics_set(METRIC_SPECTATORS, server.spectators);
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  long long work_ns = timespec_diff_ns(&end, &start);
+  server.work_ns += work_ns;
+  if (work_ns > server.work_max_ns) {
+    server.work_max_ns = work_ns;
+  }
+
+  if (++server.ticks == SERVER_REPORT_TICKS) {
+    fprintf(stderr, "sessions: %d, tick work: %.1f us avg, %.1f us max, overruns: %lld\n", server.sessions,
+        server.work_ns / 1e3 / server.ticks, server.work_max_ns / 1e3, server.overruns);
+    if (server.watch_fd >= 0) {
+      fprintf(stderr, "spectators: %d, feed: %.1f bytes per move\n", server.spectators,
+          server.feed_moves > 0 ? (double) server.feed_bytes / server.feed_moves : 0.0);
+    }
+    server.ticks = 0;
+    server.feed_moves = 0;
+    server.feed_bytes = 0;
+    server.overruns = 0;
+    server.work_ns = 0;
+    server.work_max_ns = 0;
+  }
+}
+
+// Val: Put a session on the wheel, due in ticks ticks.
+void session_schedule(struct Session *session, int ticks) {
+  if (ticks < 1) {
+    ticks = 1;
+  } else if (ticks >= WHEEL_SLOTS) {
+    ticks = WHEEL_SLOTS - 1;
+  }
+  struct Session **slot = &server.wheel[(server.tick + ticks) % WHEEL_SLOTS];
+  session->wheel_next = *slot;
+  if (*slot != NULL) {
+    (*slot)->wheel_prev = &session->wheel_next;
+  }
+  session->wheel_prev = slot;
+  *slot = session;
+}
+
+// Val: Take a session off the wheel.
+void session_unschedule(struct Session *session) {
+  if (session->wheel_prev == NULL) {
+    return;
+  }
+  *session->wheel_prev = session->wheel_next;
+  if (session->wheel_next != NULL) {
+    session->wheel_next->wheel_prev = session->wheel_prev;
+  }
+  session->wheel_prev = NULL;
+}
+
+// Val: Read and apply whatever the client sent. Returns FALSE if it hung up.
+int session_read(struct Session *session) {
+  unsigned char buf[256];
+  ssize_t len;
+  while ((len = recv(session->fd, buf, sizeof(buf), 0)) > 0) {
+    for (ssize_t i = 0; i < len; ++i) {
+      int byte = buf[i];
+      switch (session->input_state) {
+        case INPUT_KEY:
+          if (byte == 033) {
+            session->input_state = INPUT_ESC;
+          } else if (byte == 0377) {
+            session->input_state = INPUT_IAC;
+          } else if (byte == 'q' || byte == 3 || byte == 4) {
+            // q, ^C or ^D: leave.
+            return FALSE;
+          }
+          break;
+        case INPUT_ESC:
+          session->input_state = byte == '[' || byte == 'O' ? INPUT_CSI : INPUT_KEY;
+          break;
+        case INPUT_CSI:
+          if (byte >= 'A' && byte <= 'D') {
+            static const int arrows[4] = { KEY_UP, KEY_DOWN, KEY_RIGHT, KEY_LEFT };
+            if (!queue_turn(&session->game.snakes[0], arrows[byte - 'A'])) {
+              ++server.tally[METRIC_INPUTS_DROPPED];
+            }
+          }
+          // Anything but parameters ends the sequence.
+          if (byte < '0' || byte > '?') {
+            session->input_state = INPUT_KEY;
+          }
+          break;
+        case INPUT_IAC:
+          session->input_state = byte >= 0373 && byte <= 0376 ? INPUT_IAC_OPT : byte == 0372 ? INPUT_SB : INPUT_KEY;
+          break;
+        case INPUT_IAC_OPT:
+          session->input_state = INPUT_KEY;
+          break;
+        case INPUT_SB:
+          if (byte == 0377) {
+            session->input_state = INPUT_SB_IAC;
+          }
+          break;
+        case INPUT_SB_IAC:
+          session->input_state = byte == 0360 ? INPUT_KEY : INPUT_SB;
+          break;
+      }
+    }
+  }
+  return len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+}
+
+// Val: Queue output for the client (drops the client if its buffer overflows).
+void session_printf(struct Session *session, const char *format, ...) {
+  if (session->out_len < 0) {
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  int room = session->out_size - session->out_len;
+  int len = vsnprintf(session->out + session->out_len, room, format, args);
+  va_end(args);
+  // A client that can't keep up gets cut off rather than buffered without limit.
+  session->out_len = len < room ? session->out_len + len : -1;
+}
+
+// Val: Send buffered output. Returns FALSE if the session was closed.
+int session_flush(struct Session *session) {
+  if (session->out_len < 0) {
+    session_close(session);
+    return FALSE;
+  }
+
+  int sent = 0;
+  while (sent < session->out_len) {
+    ssize_t len = send(session->fd, session->out + sent, session->out_len - sent, MSG_NOSIGNAL);
+    if (len < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      session_close(session);
+      return FALSE;
+    }
+    sent += len;
+  }
+  server.tally[METRIC_RENDER_BYTES] += sent;
+  session->out_len -= sent;
+  memmove(session->out, session->out + sent, session->out_len);
+
+  if (session->out_len == 0 && session->closing) {
+    session_close(session);
+    return FALSE;
+  }
+
+  // Only ask for EPOLLOUT while something is stuck in the buffer.
+  int writing = session->out_len > 0;
+  if (writing != session->writing) {
+    struct epoll_event event = { .events = EPOLLIN | (writing ? EPOLLOUT : 0), .data.ptr = session };
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_MOD, session->fd, &event);
+    session->writing = writing;
+  }
+  return TRUE;
+}
+
+// Val: Close the connection. The slot goes back in server_release, once
+// the event batch that might still mention it is done.
+void session_close(struct Session *session) {
+  if (session->closed) {
+    return;
+  }
+  session->closed = TRUE;
+  session_unschedule(session);
+  // Player left mid-game.
+  feed_end(session, PLAYING);
+  *session->all_prev = session->all_next;
+  if (session->all_next != NULL) {
+    session->all_next->all_prev = session->all_prev;
+  }
+  close(session->fd);
+  session->closed_next = server.closed_sessions;
+  server.closed_sessions = session;
+  --server.sessions;
+  server_set_accepting(TRUE);
+}
+
+// Val: Draw what a tick changed, like render_tick but into the output buffer.
+void session_render(struct Session *session, struct TickEvents *events) {
+  struct GameState *game = &session->game;
+  struct Frame frame;
+  frame.count = 0;
+
+  for (int i = 0; i < events->moved; ++i) {
+    draw_snake(game, &events->moves[i], &frame);
+  }
+  if (events->trophy_erased) {
+    frame_put(&frame, events->erased_trophy, GLYPH_BLANK);
+  }
+  if (events->trophy_spawned) {
+    draw_trophy(game, &frame);
+  }
+
+  // Cursor moves are 1-based; colors only change when they have to
+  // (output is always left in the default color between frames).
+  int color = COLOR_DEFAULT;
+  for (int i = 0; i < frame.count; ++i) {
+    int glyph = frame.cells[i].glyph;
+    if (ansi_glyph_colors[glyph] != color) {
+      color = ansi_glyph_colors[glyph];
+      session_printf(session, "%s", ansi_colors[color]);
+    }
+    session_printf(session, "\033[%d;%dH%s", frame.cells[i].pos.r + 1, frame.cells[i].pos.c + 1, ansi_glyphs[glyph]);
+  }
+  if (color > COLOR_DEFAULT) {
+    session_printf(session, "%s", ansi_colors[COLOR_DEFAULT]);
+  }
+
+  if (session->spectators != NULL) {
+    // The same cells for spectators, a few bytes each.
+    int message_len = events->message != NULL ? strlen(events->message) : 0;
+    if (message_len > 255) {
+      message_len = 255;
+    }
+    struct FeedChunk *chunk = feed_chunk_new(frame.count * 6 + 16 + message_len);
+    if (chunk != NULL) {
+      for (int i = 0; i < frame.count; ++i) {
+        feed_put_cell(chunk, game, frame.cells[i].pos, frame.cells[i].glyph);
+      }
+      if (events->ate) {
+        feed_put(chunk, FEED_LENGTH);
+        feed_put_varint(chunk, game->snakes[0].len);
+        feed_put_varint(chunk, game->snake_win_len);
+      }
+      if (message_len > 0) {
+        feed_put(chunk, FEED_MESSAGE);
+        feed_put(chunk, message_len);
+        for (int i = 0; i < message_len; ++i) {
+          feed_put(chunk, events->message[i]);
+        }
+      }
+      server.feed_moves += events->moved;
+      server.feed_bytes += chunk->len;
+    }
+    feed_publish(session, chunk);
+
+    // Now and then the whole board, so spectators that fell behind can catch up.
+    if (server.tick - session->keyframe_tick >= FEED_KEYFRAME_TICKS) {
+      feed_publish(session, feed_keyframe(session));
+    }
+  }
+
+  if (events->ate) {
+    // Win condition status, where the terminal game puts it.
+    session_printf(session, "\033[%d;3HWin: %d/%d", game->pit_lines, game->snakes[0].len, game->snake_win_len);
+  }
+
+  if (events->message != NULL) {
+    int len = strlen(events->message);
+    if (len > game->pit_cols - 2) {
+      len = game->pit_cols - 2;
+    }
+    session_printf(session, "\033[%d;%dH%.*s", game->pit_lines, game->pit_cols / 2 - len / 2 + 1, len, events->message);
+  }
+}
+
+// Val: Accept every pending spectator.
+void spectator_accept() {
+  while (1) {
+    int fd = accept(server.watch_fd, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EMFILE || errno == ENFILE) {
+        server_set_accepting(FALSE);
+      }
+      return;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+
+    // At the cap: turn it away.
+    struct Spectator *spectator = pool_get(&server.spectator_pool);
+    if (spectator == NULL) {
+      close(fd);
+      continue;
+    }
+    memset(spectator, 0, sizeof(struct Spectator));
+    spectator->kind = CONN_SPECTATOR;
+    spectator->fd = fd;
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = spectator };
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    ++server.spectators;
+  }
+}
+
+// Val: Read the game number (or notice a hang-up). Returns FALSE if it hung up.
+int spectator_read(struct Spectator *spectator) {
+  char buf[64];
+  ssize_t len;
+  while ((len = recv(spectator->fd, buf, sizeof(buf), 0)) > 0) {
+    for (ssize_t i = 0; i < len; ++i) {
+      // Anything after the request is ignored.
+      if (spectator->session != NULL || spectator->closing) {
+        break;
+      }
+      if (buf[i] != '\n') {
+        if (spectator->request_len == FEED_REQUEST_MAX - 1) {
+          return FALSE;
+        }
+        spectator->request[spectator->request_len++] = buf[i];
+        continue;
+      }
+
+      spectator->request[spectator->request_len] = '\0';
+      int id = atoi(spectator->request);
+      struct Session *session = server.all;
+      while (session != NULL && (session->id != id || session->closing)) {
+        session = session->all_next;
+      }
+      if (session == NULL) {
+        return FALSE;
+      }
+
+      spectator->session = session;
+      spectator->next = session->spectators;
+      if (session->spectators != NULL) {
+        session->spectators->prev = &spectator->next;
+      }
+      spectator->prev = &session->spectators;
+      session->spectators = spectator;
+
+      // Start from the whole board; deltas follow from the next tick.
+      struct FeedChunk *chunk = feed_keyframe(session);
+      feed_queue(spectator, chunk);
+      feed_chunk_release(chunk);
+    }
+  }
+  return len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+}
+
+// Val: Send queued chunks. Returns FALSE if the spectator was closed.
+int spectator_flush(struct Spectator *spectator) {
+  while (spectator->queue_len > 0) {
+    // Straight out of the shared chunks, however many are waiting.
+    struct iovec iov[FEED_QUEUE_MAX];
+    for (int i = 0; i < spectator->queue_len; ++i) {
+      struct FeedChunk *chunk = spectator->queue[(spectator->queue_head + i) % FEED_QUEUE_MAX];
+      int skip = i == 0 ? spectator->sent : 0;
+      iov[i].iov_base = chunk->data + skip;
+      iov[i].iov_len = chunk->len - skip;
+    }
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = spectator->queue_len };
+    ssize_t len = sendmsg(spectator->fd, &msg, MSG_NOSIGNAL);
+    if (len < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      spectator_close(spectator);
+      return FALSE;
+    }
+
+    // Let go of the chunks that are all out.
+    spectator->sent += len;
+    while (spectator->queue_len > 0 && spectator->sent >= spectator->queue[spectator->queue_head]->len) {
+      spectator->sent -= spectator->queue[spectator->queue_head]->len;
+      feed_chunk_release(spectator->queue[spectator->queue_head]);
+      spectator->queue_head = (spectator->queue_head + 1) % FEED_QUEUE_MAX;
+      --spectator->queue_len;
+    }
+  }
+
+  if (spectator->queue_len == 0 && spectator->closing) {
+    spectator_close(spectator);
+    return FALSE;
+  }
+
+  // Only ask for EPOLLOUT while something is waiting.
+  int writing = spectator->queue_len > 0;
+  if (writing != spectator->writing) {
+    struct epoll_event event = { .events = EPOLLIN | (writing ? EPOLLOUT : 0), .data.ptr = spectator };
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_MOD, spectator->fd, &event);
+    spectator->writing = writing;
+  }
+  return TRUE;
+}
+
+// Val: Close the connection and drop the spectator's queued chunks. The
+// slot goes back in server_release, like a session's.
+void spectator_close(struct Spectator *spectator) {
+  if (spectator->closed) {
+    return;
+  }
+  spectator->closed = TRUE;
+  if (spectator->session != NULL) {
+    *spectator->prev = spectator->next;
+    if (spectator->next != NULL) {
+      spectator->next->prev = spectator->prev;
+    }
+  }
+  for (int i = 0; i < spectator->queue_len; ++i) {
+    feed_chunk_release(spectator->queue[(spectator->queue_head + i) % FEED_QUEUE_MAX]);
+  }
+  spectator->queue_len = 0;
+  close(spectator->fd);
+  spectator->closed_next = server.closed_spectators;
+  server.closed_spectators = spectator;
+  --server.spectators;
+  server_set_accepting(TRUE);
+}
+
+// Val: New chunk with room for size bytes, holding one reference (NULL if
+// the pool is out of chunks, or they're smaller than that).
+struct FeedChunk *feed_chunk_new(int size) {
+  struct FeedChunk *chunk = size <= server.chunk_size ? pool_get(&server.chunk_pool) : NULL;
+  if (chunk != NULL) {
+    chunk->refs = 1;
+    chunk->keyframe = FALSE;
+    chunk->len = 0;
+    chunk->size = size;
+  }
+  return chunk;
+}
+
+// Val: Drop a reference, returning the chunk to the pool with the last one.
+void feed_chunk_release(struct FeedChunk *chunk) {
+  if (chunk != NULL && --chunk->refs == 0) {
+    pool_put(&server.chunk_pool, chunk);
+  }
+}
+
+// Val: Append a byte (the size given to feed_chunk_new must cover it).
+void feed_put(struct FeedChunk *chunk, int byte) {
+  if (chunk->len < chunk->size) {
+    chunk->data[chunk->len++] = byte;
+  }
+}
+
+// Val: Append an unsigned LEB128 varint.
+void feed_put_varint(struct FeedChunk *chunk, unsigned long long value) {
+  while (value >= 0x80) {
+    feed_put(chunk, (value & 0x7F) | 0x80);
+    value >>= 7;
+  }
+  feed_put(chunk, value);
+}
+
+// Val: Append a cell record.
+void feed_put_cell(struct FeedChunk *chunk, struct GameState *game, struct Coord pos, int glyph) {
+  feed_put(chunk, glyph);
+  feed_put_varint(chunk, pos.r * game->pit_cols + pos.c);
+}
+
+// Val: Whole board as a keyframe chunk.
+struct FeedChunk *feed_keyframe(struct Session *session) {
+  struct GameState *game = &session->game;
+  int cells = 1;
+  for (int i = 0; i < game->snake_count; ++i) {
+    if (game->snakes[i].alive) {
+      cells += game->snakes[i].body_len;
+    }
+  }
+  struct FeedChunk *chunk = feed_chunk_new(16 + cells * 6);
+  if (chunk == NULL) {
+    return NULL;
+  }
+  chunk->keyframe = TRUE;
+
+  feed_put(chunk, FEED_KEYFRAME);
+  feed_put(chunk, game->pit_lines & 0xFF);
+  feed_put(chunk, game->pit_lines >> 8);
+  feed_put(chunk, game->pit_cols & 0xFF);
+  feed_put(chunk, game->pit_cols >> 8);
+  feed_put(chunk, FEED_LENGTH);
+  feed_put_varint(chunk, game->snakes[0].len);
+  feed_put_varint(chunk, game->snake_win_len);
+
+  // Walk each body from the tail.
+  for (int i = 0; i < game->snake_count; ++i) {
+    struct Snake *snake = &game->snakes[i];
+    if (!snake->alive) {
+      continue;
+    }
+    for (int j = 0, ptr = snake->tail_ptr; j < snake->body_len; ++j, ptr = (ptr + 1) % game->snake_win_len) {
+      feed_put_cell(chunk, game, cell_coord(snake->elements[ptr]), segment_glyph(game, snake, j));
+    }
+  }
+  if (game->trophy.value > 0) {
+    feed_put_cell(chunk, game, game->trophy.pos, GLYPH_TROPHY + game->trophy.value - 1);
+  }
+  return chunk;
+}
+
+// Val: Queue a chunk for every spectator of a session, then drop the caller's reference.
+void feed_publish(struct Session *session, struct FeedChunk *chunk) {
+  if (chunk != NULL && chunk->keyframe) {
+    session->keyframe_tick = server.tick;
+  }
+  struct Spectator *next;
+  for (struct Spectator *spectator = session->spectators; spectator != NULL; spectator = next) {
+    next = spectator->next;
+    feed_queue(spectator, chunk);
+    spectator_flush(spectator);
+  }
+  feed_chunk_release(chunk);
+}
+
+// Val: Queue a chunk for one spectator, to go out on its next flush (NULL: it missed one).
+void feed_queue(struct Spectator *spectator, struct FeedChunk *chunk) {
+  if (chunk == NULL) {
+    spectator->resync = TRUE;
+    return;
+  }
+  if (spectator->resync) {
+    if (!chunk->keyframe) {
+      return;
+    }
+    spectator->resync = FALSE;
+  }
+
+  if (spectator->queue_len == FEED_QUEUE_MAX) {
+    // Too far behind: drop the backlog (but finish the chunk being sent, so
+    // records stay whole) and pick up again at a keyframe.
+    int keep = spectator->sent > 0;
+    while (spectator->queue_len > keep) {
+      --spectator->queue_len;
+      feed_chunk_release(spectator->queue[(spectator->queue_head + spectator->queue_len) % FEED_QUEUE_MAX]);
+    }
+    if (!chunk->keyframe) {
+      spectator->resync = TRUE;
+      return;
+    }
+  }
+
+  ++chunk->refs;
+  spectator->queue[(spectator->queue_head + spectator->queue_len) % FEED_QUEUE_MAX] = chunk;
+  ++spectator->queue_len;
+}
+
+// Val: Tell a session's spectators the game is over (state as sim_tick returns it) and let them go.
+void feed_end(struct Session *session, int state) {
+  if (session->spectators == NULL) {
+    return;
+  }
+  // Counts as a keyframe so spectators that fell behind still get it.
+  struct FeedChunk *chunk = feed_chunk_new(2);
+  if (chunk != NULL) {
+    chunk->keyframe = TRUE;
+    feed_put(chunk, FEED_END);
+    feed_put(chunk, state & 0xFF);
+  }
+
+  struct Spectator *next;
+  for (struct Spectator *spectator = session->spectators; spectator != NULL; spectator = next) {
+    next = spectator->next;
+    spectator->session = NULL;
+    spectator->closing = TRUE;
+    feed_queue(spectator, chunk);
+    spectator_flush(spectator);
+  }
+  session->spectators = NULL;
+  feed_chunk_release(chunk);
+}
+// Val: Run every case (or just the given board). Returns non-zero on error.
+int run_bench(int lines, int cols) {
+  printf("board\tlength\tmove_ns\teat_ns\tspawn_ns\tspawn_free\tframe_bytes\tfork_ns\n");
+  for (int i = 0; i < (int) BENCH_BOARDS; ++i) {
+    int board_lines = lines > 0 ? lines : bench_boards[i].r;
+    int board_cols = cols > 0 ? cols : bench_boards[i].c;
+    // Short, half and full winning length.
+    int win_len = board_lines + board_cols;
+    int lengths[3] = { 8, win_len / 2, win_len };
+    for (int j = 0; j < 3; ++j) {
+      if (!bench_case(board_lines, board_cols, lengths[j])) {
+        return 1;
+      }
+    }
+    if (lines > 0) {
+      break;
+    }
+  }
+  return 0;
+}
+
+// Val: Nanoseconds since start, per operation.
+static double bench_ns(struct timespec *start, long long count) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (double) timespec_diff_ns(&end, start) / count;
+}
+
+// Val: One board and snake length.
+int bench_case(int lines, int cols, int length) {
+  // The snake's cycle: rows snake back and forth from column 2 to the right
+  // edge, and column 1 leads back up. Needs an even number of rows inside the border.
+  int rows = lines - 2;
+  if (rows % 2 != 0 || cols < 5) {
+    fprintf(stderr, "Board %dx%d needs an even number of lines inside the border.\n", cols, lines);
+    return FALSE;
+  }
+
+  // A session so the server's renderer can be measured on the same game.
+  struct Session *session = calloc(1, sizeof(struct Session) + SESSION_OUT_SIZE);
+  if (session == NULL) {
+    fprintf(stderr, "Out of memory.\n");
+    return FALSE;
+  }
+  session->out = (char *) session + sizeof(struct Session);
+  session->out_size = SESSION_OUT_SIZE;
+  struct GameState *game = &session->game;
+  game->pit_lines = lines;
+  game->pit_cols = cols;
+  game->seed = 1;
+  struct TickEvents events;
+  if (!reset_snake(game, &events)) {
+    fprintf(stderr, "Out of memory.\n");
+    free(session);
+    return FALSE;
+  }
+  struct Snake *snake = &game->snakes[0];
+
+  unsigned char *cycle = malloc(lines * cols);
+  if (cycle == NULL) {
+    fprintf(stderr, "Out of memory.\n");
+    free_game(game);
+    free(session);
+    return FALSE;
+  }
+  for (int r = 1; r <= rows; ++r) {
+    for (int c = 1; c < cols - 1; ++c) {
+      int dir;
+      if (c == 1) {
+        dir = r == 1 ? KEY_RIGHT : KEY_UP;
+      } else if (r % 2 == 1) {
+        dir = c < cols - 2 ? KEY_RIGHT : KEY_DOWN;
+      } else {
+        dir = c > 2 ? KEY_LEFT : r == rows ? KEY_LEFT : KEY_DOWN;
+      }
+      cycle[r * cols + c] = DIR_INDEX(dir);
+    }
+  }
+
+  // Point the fresh snake along the cycle and let it grow to length.
+  struct Coord head = cell_coord(snake->elements[snake->head_ptr]);
+  snake->dir = KEY_DOWN + cycle[head.r * cols + head.c];
+  snake->prev_dir = snake->dir;
+  snake->len = length;
+  snake->growth = length - snake->body_len;
+
+  struct SnakeMove move = { 0 };
+  struct Coord next_head;
+  struct timespec start;
+  int game_state = PLAYING;
+  for (int i = 0; i < length && game_state == PLAYING; ++i) {
+    head = cell_coord(snake->elements[snake->head_ptr]);
+    game_state = update_next_head(game, snake, KEY_DOWN + cycle[head.r * cols + head.c], &next_head, &events);
+    advance_snake(game, snake, &next_head, &move);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < BENCH_MOVES && game_state == PLAYING; ++i) {
+    head = cell_coord(snake->elements[snake->head_ptr]);
+    game_state = update_next_head(game, snake, KEY_DOWN + cycle[head.r * cols + head.c], &next_head, &events);
+    advance_snake(game, snake, &next_head, &move);
+  }
+  double move_ns = bench_ns(&start, BENCH_MOVES);
+
+  // Bytes per move through the server's renderer.
+  long long frame_bytes = 0;
+  events.moved = 1;
+  for (int i = 0; i < BENCH_FRAMES && game_state == PLAYING; ++i) {
+    clear_events(&events);
+    head = cell_coord(snake->elements[snake->head_ptr]);
+    game_state = update_next_head(game, snake, KEY_DOWN + cycle[head.r * cols + head.c], &next_head, &events);
+    struct SnakeMove *frame_move = &events.moves[events.moved++];
+    frame_move->snake = 0;
+    frame_move->ate = 0;
+    advance_snake(game, snake, &next_head, frame_move);
+    session_render(session, &events);
+    frame_bytes += session->out_len;
+    session->out_len = 0;
+  }
+
+  if (game_state != PLAYING) {
+    fprintf(stderr, "Bench snake died on %dx%d: %s\n", cols, lines, events.message);
+    free(cycle);
+    free_game(game);
+    free(session);
+    return FALSE;
+  }
+
+  // Eating: the trophy is always where the head is, and the growth is taken
+  // back each time so the snake stays the same.
+  int len = snake->len;
+  int growth = snake->growth;
+  head = cell_coord(snake->elements[snake->head_ptr]);
+  game->trophy.value = 1;
+  long long eaten = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < BENCH_EATS; ++i) {
+    game->trophy.pos = head;
+    eaten += award_trophy(game, snake, &head);
+    snake->len = len;
+    snake->growth = growth;
+  }
+  double eat_ns = bench_ns(&start, BENCH_EATS);
+
+  // Fill the pit (as if with other snakes) until only a few cells are free.
+  // Val: Sparse boards are left as they are: they place trophies by sampling,
+  // which is only meant for boards the snakes can't fill.
+  int spawn_free = (lines - 2) * (cols - 2) * BENCH_FREE_PERCENT / 100;
+  if (spawn_free < 1) {
+    spawn_free = 1;
+  }
+  while (game->chunks == NULL && game->free_cells_count > spawn_free) {
+    int cell = game->free_cells[game->free_cells_count - 1];
+    take_cell(game, cell / cols, cell % cols, 2);
+  }
+  spawn_free = game->free_cells_count;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < BENCH_SPAWNS; ++i) {
+    clear_events(&events);
+    generate_trophy(game, &events);
+  }
+  double spawn_ns = bench_ns(&start, BENCH_SPAWNS);
+
+  // Val: Forking, as a search would: over and over into the same copy.
+  struct GameState copy = { 0 };
+  long long forks = BENCH_FORK_BYTES / snapshot_size(game) + 1;
+  long long forked = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (long long i = 0; i < forks; ++i) {
+    forked += fork_game(&copy, game);
+  }
+  double fork_ns = bench_ns(&start, forks);
+  if (forked != forks || copy.free_cells_count != game->free_cells_count) {
+    fprintf(stderr, "Bench fork failed on %dx%d\n", cols, lines);
+    fork_ns = -1;
+  }
+  free_game(&copy);
+
+  printf("%dx%d\t%d\t%.2f\t%.2f\t%.2f\t%d\t%.1f\t%.0f\n", cols, lines, length, move_ns, eat_ns, spawn_ns,
+      spawn_free, (double) frame_bytes / BENCH_FRAMES, fork_ns);
+  fflush(stdout);
+
+  free(cycle);
+  free_game(game);
+  free(session);
+  return eaten == BENCH_EATS;
+}
+#endif
+
+// Adam: Set up a new snake.
+int reset_snake(struct GameState *game, struct TickEvents *events) {
+  if (game->snake_count < 1) {
+    game->snake_count = 1;
+  } else if (game->snake_count > SNAKES_MAX) {
+    game->snake_count = SNAKES_MAX;
+  }
+
+  // Length of half of the perimeter means user wins the game.
+  // Val: Unless a winning length was given (big boards would take forever).
+  game->snake_win_len = game->win_len > 0 ? game->win_len : game->pit_lines + game->pit_cols;
+
+  // Val: Big boards are sparse: no grid or index in the block, chunks instead.
+  // Chunks from the last game are cleared and kept as spares.
+  int sparse = (long long) game->pit_lines * game->pit_cols > SPARSE_CELLS;
+  for (int i = 0; game->chunks != NULL && i < game->chunk_rows * game->chunk_cols; ++i) {
+    if (game->chunks[i] != NULL) {
+      memset(game->chunks[i]->cells, 0, sizeof(game->chunks[i]->cells));
+      game->chunks[i]->used = 0;
+      game->chunks[i]->next = game->spare_chunks;
+      game->spare_chunks = game->chunks[i];
+    }
+  }
+  if (sparse) {
+    game->chunk_rows = (game->pit_lines + PIT_CHUNK - 1) / PIT_CHUNK;
+    game->chunk_cols = (game->pit_cols + PIT_CHUNK - 1) / PIT_CHUNK;
+    if (game->chunk_rows * game->chunk_cols > game->chunks_size) {
+      free(game->chunks);
+      game->chunks_size = game->chunk_rows * game->chunk_cols;
+      game->chunks = malloc(sizeof(struct PitChunk *) * game->chunks_size);
+      if (game->chunks == NULL) {
+        game->chunks_size = 0;
+        free_game(game);
+        return FALSE;
+      }
+    }
+    memset(game->chunks, 0, sizeof(struct PitChunk *) * game->chunk_rows * game->chunk_cols);
+  } else {
+    free(game->chunks);
+    game->chunks = NULL;
+    game->chunks_size = 0;
+  }
+
+  // If the snakes, rings or the pit got bigger, re-allocate: they're all carved
+  // out of one block so a game's data stays together.
+  int new_cells_size = sparse ? 0 : game->pit_lines * game->pit_cols;
+  if (game->snake_count > game->snakes_size || game->snake_win_len > game->ring_size
+      || new_cells_size > game->cells_size) {
+    free(game->block);
+    game->snakes_size = game->snake_count;
+    game->ring_size = game->snake_win_len;
+    game->cells_size = new_cells_size;
+    game->block = malloc(game_block_size(game->snakes_size, game->ring_size, game->cells_size));
+    if (game->block == NULL) {
+      free_game(game);
+      return FALSE;
+    }
+    layout_block(game);
+  }
+  memset(game->pit_cells, 0, game->cells_size);
+  build_speed_table(game);
+
+  // Every cell inside the border starts out free.
+  if (sparse) {
+    game->free_cells_count = (game->pit_lines - 2) * (game->pit_cols - 2);
+  } else {
+    index_free_cells(game);
+  }
+
+  // Seed pseduorandom generator (from current time unless replaying).
+  rng_seed(&game->rng, game->seed);
+
+  // Trophy is generated on the first tick; the snakes move right away.
+  game->trophy.pos.r = 0;
+  game->trophy.pos.c = 0;
+  game->trophy.value = 0;
+  game->ticks_till_new_trophy = 0;
+
+  clear_events(events);
+  game->snakes_alive = 0;
+  for (int i = 0; i < game->snake_count; ++i) {
+    struct Snake *snake = &game->snakes[i];
+
+    // Start as just a head; the rest grows in over the first moves.
+    snake->len = 3;
+    snake->body_len = 0;
+    snake->growth = snake->len;
+    snake->head_ptr = -1; // First move will increment.
+    snake->tail_ptr = 0;
+    snake->alive = TRUE;
+
+    // Initialize head in the middle of the field.
+    // Val: The first snake, anyway; the others start anywhere free.
+    struct Coord head;
+    if (i == 0) {
+      head.r = game->pit_lines / 2;
+      head.c = game->pit_cols / 2;
+    } else if (!random_free_cell(game, &head, NULL)) {
+      // No room left for more snakes.
+      game->snake_count = i;
+      break;
+    }
+
+    // Random starting direction.
+    snake->dir = KEY_DOWN + rng_below(&game->rng, 4);
+    snake->prev_dir = snake->dir;
+
+    // Drop turns left over from a previous game.
+    snake->turn_queue_head = 0;
+    snake->turn_queue_len = 0;
+
+    snake->speed_carry = 0;
+    snake->ticks_per_move = get_ticks_per_move(game, snake);
+    snake->ticks_since_move = snake->ticks_per_move - 1;
+
+    // Finalize snake.
+    struct SnakeMove *move = &events->moves[events->moved++];
+    move->snake = i;
+    move->ate = 0;
+    advance_snake(game, snake, &head, move);
+    ++game->snakes_alive;
+  }
+  return TRUE;
+}
+
+// Val: Reset events for a new step (the moves array is left as it is).
+void clear_events(struct TickEvents *events) {
+  events->moved = 0;
+  events->ate = 0;
+  events->died = 0;
+  events->trophy_erased = FALSE;
+  events->trophy_spawned = FALSE;
+  events->spawn_misses = 0;
+  events->message = NULL;
+}
+
+// Val: Release a game's memory (the GameState itself belongs to the caller).
+void free_game(struct GameState *game) {
+  free(game->block);
+  free(game->replay.data);
+  game->block = NULL;
+  game->replay.data = NULL;
+  game->snakes = NULL;
+  game->snakes_size = 0;
+  game->ring_size = 0;
+  game->cells_size = 0;
+
+  // Val: Chunks in use, then the spares.
+  for (int i = 0; game->chunks != NULL && i < game->chunk_rows * game->chunk_cols; ++i) {
+    free(game->chunks[i]);
+  }
+  while (game->spare_chunks != NULL) {
+    struct PitChunk *next = game->spare_chunks->next;
+    free(game->spare_chunks);
+    game->spare_chunks = next;
+  }
+  free(game->chunks);
+  game->chunks = NULL;
+  game->chunks_size = 0;
+}
+
+// Val: Point snakes, rings, speed table, free-cell index and grid into the block.
+void layout_block(struct GameState *game) {
+  game->snakes = game->block;
+  uint32_t *rings = (uint32_t *) (game->snakes + game->snakes_size);
+  for (int i = 0; i < game->snakes_size; ++i) {
+    game->snakes[i].elements = rings + i * game->ring_size;
+  }
+  game->speed_table = (uint16_t *) (rings + game->ring_size * game->snakes_size);
+  game->free_cells = (int *) (game->speed_table + SPEED_TABLE_LEN(game->ring_size));
+  game->free_cells_pos = game->free_cells + game->cells_size;
+  game->pit_cells = (unsigned char *) (game->free_cells_pos + game->cells_size);
+}
+
+// Val: Bytes a block for these many snakes, ring slots and pit cells takes.
+size_t game_block_size(int snakes, int ring, int cells) {
+  return sizeof(struct Snake) * snakes + sizeof(uint32_t) * ring * snakes + sizeof(uint16_t) * SPEED_TABLE_LEN(ring)
+      + 2 * sizeof(int) * cells + cells;
+}
+
+// Val: Fill in the speed table from the game's curve (classic if it has none).
+void build_speed_table(struct GameState *game) {
+  struct SpeedCurve *curve = &game->speed;
+  if (curve->slow <= 0) {
+    *curve = speed_profiles[0].curve;
+  }
+  for (int len = 0; len <= game->snake_win_len; ++len) {
+    double ratio = len;
+    ratio /= game->snake_win_len;
+    int ticks;
+    if (curve->stepped) {
+      // Adam's curve, worked out the same way so classic games play the same.
+      double delta = (curve->slow - curve->fast) / SPEED_ONE + 1;
+      ticks = (int) (curve->slow / SPEED_ONE - (delta * ratio)) * SPEED_ONE;
+    } else {
+      ticks = curve->slow - (int) ((curve->slow - curve->fast) * ratio + 0.5);
+    }
+    game->speed_table[len] = ticks > SPEED_ONE ? ticks : SPEED_ONE;
+  }
+}
+
+// Val: Read a speed curve: a profile name, or SLOW:FAST ticks per move (a
+// smooth curve, fractions allowed). Returns FALSE unless 1 <= FAST <= SLOW <= SPEED_TICKS_MAX.
+int parse_speed(const char *text, struct SpeedCurve *curve) {
+  for (int i = 0; i < (int) SPEED_PROFILES; ++i) {
+    if (strcmp(speed_profiles[i].name, text) == 0) {
+      *curve = speed_profiles[i].curve;
+      return TRUE;
+    }
+  }
+
+  // Anything after FAST is read into end, making a third field. The tests are
+  // written so NaN (which compares false to everything) fails them.
+  double slow;
+  double fast;
+  char end;
+  if (sscanf(text, "%lf:%lf%c", &slow, &fast, &end) != 2
+      || !(fast >= 1) || !(slow >= fast) || !(slow <= SPEED_TICKS_MAX)) {
+    return FALSE;
+  }
+  curve->slow = (int) (slow * SPEED_ONE + 0.5);
+  curve->fast = (int) (fast * SPEED_ONE + 0.5);
+  curve->stepped = FALSE;
+  return TRUE;
+}
+
+// Val: Rebuild the free-cell index from the grid.
+void index_free_cells(struct GameState *game) {
+  game->free_cells_count = 0;
+  for (int r = 1; r < game->pit_lines - 1; ++r) {
+    for (int c = 1; c < game->pit_cols - 1; ++c) {
+      int cell = r * game->pit_cols + c;
+      if (!game->pit_cells[cell]) {
+        game->free_cells_pos[cell] = game->free_cells_count;
+        game->free_cells[game->free_cells_count++] = cell;
+      }
+    }
+  }
+}
+
+// Val: Change the pit size mid-game, keeping everything on it where it is
+// (so never smaller than what's on it). Returns FALSE if nothing changed.
+int resize_pit(struct GameState *game, int lines, int cols) {
+  // Val: Sparse boards are never sized from the screen.
+  if (game->chunks != NULL) {
+    return FALSE;
+  }
+
+  // Keep every live segment and the trophy inside the border.
+  int min_lines = 4;
+  int min_cols = 4;
+  for (int i = 0; i < game->snake_count; ++i) {
+    struct Snake *snake = &game->snakes[i];
+    for (int j = 0, ptr = snake->tail_ptr; snake->alive && j < snake->body_len; ++j, ptr = (ptr + 1) % game->snake_win_len) {
+      if (CELL_R(snake->elements[ptr]) + 2 > min_lines) {
+        min_lines = CELL_R(snake->elements[ptr]) + 2;
+      }
+      if (CELL_C(snake->elements[ptr]) + 2 > min_cols) {
+        min_cols = CELL_C(snake->elements[ptr]) + 2;
+      }
+    }
+  }
+  if (game->trophy.value > 0) {
+    if (game->trophy.pos.r + 2 > min_lines) {
+      min_lines = game->trophy.pos.r + 2;
+    }
+    if (game->trophy.pos.c + 2 > min_cols) {
+      min_cols = game->trophy.pos.c + 2;
+    }
+  }
+  lines = lines > min_lines ? lines : min_lines;
+  cols = cols > min_cols ? cols : min_cols;
+  if (lines == game->pit_lines && cols == game->pit_cols) {
+    return FALSE;
+  }
+
+  int old_lines = game->pit_lines;
+  int old_cols = game->pit_cols;
+  if (lines * cols > game->cells_size) {
+    // Grow the block with room to spare, so dragging a window bigger doesn't
+    // reallocate on every step. The grid is last, so it moves up intact.
+    size_t grid_offset = game->pit_cells - (unsigned char *) game->block;
+    int cells_size = lines * cols + lines * cols / 2;
+    void *block = realloc(game->block, grid_offset - 2 * sizeof(int) * game->cells_size
+        + 2 * sizeof(int) * cells_size + cells_size);
+    if (block == NULL) {
+      return FALSE;
+    }
+    game->block = block;
+    game->cells_size = cells_size;
+    layout_block(game);
+    memmove(game->pit_cells, (unsigned char *) block + grid_offset, old_lines * old_cols);
+  }
+
+  // Re-stride the grid in place: rows move toward the end when they get
+  // wider, toward the start when narrower, so neither overwrites the next.
+  unsigned char *grid = game->pit_cells;
+  int keep_lines = old_lines < lines ? old_lines : lines;
+  if (cols > old_cols) {
+    for (int r = keep_lines - 1; r >= 0; --r) {
+      memmove(grid + r * cols, grid + r * old_cols, old_cols);
+      memset(grid + r * cols + old_cols, 0, cols - old_cols);
+    }
+  } else {
+    for (int r = 0; r < keep_lines; ++r) {
+      memmove(grid + r * cols, grid + r * old_cols, cols);
+    }
+  }
+  if (lines > keep_lines) {
+    memset(grid + keep_lines * cols, 0, (lines - keep_lines) * cols);
+  }
+
+  game->pit_lines = lines;
+  game->pit_cols = cols;
+  index_free_cells(game);
+  return TRUE;
+}
+
+// Adam: Finalize move with new head.
+void advance_snake(struct GameState *game, struct Snake *snake, struct Coord *head, struct SnakeMove *move) {
+  if (snake->growth > 0) {
+    // Growing: tail stays where it is.
+    --snake->growth;
+    ++snake->body_len;
+    move->tail_moved = FALSE;
+  } else {
+    // Tail element vacates its spot and must be erased.
+    move->tail_moved = TRUE;
+    move->discarded = cell_coord(snake->elements[snake->tail_ptr]);
+    release_cell(game, move->discarded.r, move->discarded.c);
+    snake->tail_ptr = (snake->tail_ptr + 1) % game->snake_win_len;
+  }
+
+  // Update head pointer.
+  snake->head_ptr = (snake->head_ptr + 1) % game->snake_win_len;
+  snake->elements[snake->head_ptr] = CELL_PACK(head->r, head->c);
+  take_cell(game, head->r, head->c, move->snake + 1);
+}
+
+// Val: Take a dead snake off the board. Its ring is left as it was, so a
+// renderer can still walk the body to erase it.
+void kill_snake(struct GameState *game, struct Snake *snake) {
+  snake->alive = FALSE;
+  --game->snakes_alive;
+  for (int i = 0, ptr = snake->tail_ptr; i < snake->body_len; ++i, ptr = (ptr + 1) % game->snake_win_len) {
+    release_cell(game, CELL_R(snake->elements[ptr]), CELL_C(snake->elements[ptr]));
+  }
+}
+
+// Val: Advance the game by some ticks. Returns game state.
+int sim_tick(struct GameState *game, int ticks, struct TickEvents *events) {
+  clear_events(events);
+
+  // Tick counter for trophy generation.
+  game->ticks_till_new_trophy -= ticks;
+
+  // Val: Snakes move one after another in index order, so each one sees the
+  // new heads and vacated tails of the snakes before it.
+  for (int i = 0; i < game->snake_count; ++i) {
+    struct Snake *snake = &game->snakes[i];
+    if (!snake->alive) {
+      continue;
+    }
+
+    // Tick snake if it is supposed to move.
+    snake->ticks_since_move += ticks;
+    if (snake->ticks_since_move < snake->ticks_per_move) {
+      continue;
+    }
+    // Reset ticks since snake moved.
+    snake->ticks_since_move = 0;
+
+    // Each move applies one queued turn (or the recorded one on playback).
+    // Replays only hold the first snake's turns.
+    int input;
+    if (i == 0 && game->replay.mode == REPLAY_PLAY) {
+      input = replay_next_input(game);
+    } else {
+      input = next_turn(snake);
+      if (i == 0 && game->replay.mode == REPLAY_RECORD) {
+        replay_record(game, input);
+      }
+    }
+
+    // Prepare to move snake.
+    struct Coord next_head;
+    PROFILE_START(move_start);
+    int game_state = update_next_head(game, snake, input, &next_head, events);
+    PROFILE_END(PHASE_MOVE, move_start);
+
+    // If game is over, don't wait until next tick.
+    if (game_state == WIN) {
+      return WIN;
+    } else if (game_state == LOSS) {
+      kill_snake(game, snake);
+      ++events->died;
+      if (game->snakes_alive == 0) {
+        return LOSS;
+      }
+      continue;
+    }
+
+    // If new head will consume trophy, award it.
+    struct SnakeMove *move = &events->moves[events->moved++];
+    move->snake = i;
+    PROFILE_START(award_start);
+    move->ate = award_trophy(game, snake, &next_head);
+    PROFILE_END(PHASE_AWARD, award_start);
+    if (move->ate) {
+      events->ate += move->ate;
+      // Prepare to draw new trophy next tick.
+      game->ticks_till_new_trophy = -1;
+    }
+
+    // Move head.
+    advance_snake(game, snake, &next_head, move);
+
+    // Update speed for new length.
+    // Val: Every move, not just on eating, to carry fractions of a tick.
+    snake->ticks_per_move = get_ticks_per_move(game, snake);
+
+    // Check for a win after head has moved so trophy isn't sitting there "unconsumed" on win.
+    if (snake->len >= game->snake_win_len) {
+      return WIN;
+    }
+  }
+
+  // Handle trophy generation.
+  // Snake moves before trophy is regenerated so that ties
+  // (snake tries to eat trophy the tick it expires)
+  // go to the player, which feels less frustrating.
+  if (game->ticks_till_new_trophy <= 0) {
+    PROFILE_START(trophy_start);
+    generate_trophy(game, events);
+    PROFILE_END(PHASE_TROPHY, trophy_start);
+  }
+
+  return PLAYING;
+}
+
+// Val: Ticks until the next move or trophy expiry (nothing happens before then).
+int sim_idle_ticks(struct GameState *game) {
+  int idle_ticks = game->ticks_till_new_trophy;
+  for (int i = 0; i < game->snake_count; ++i) {
+    struct Snake *snake = &game->snakes[i];
+    if (snake->alive && snake->ticks_per_move - snake->ticks_since_move < idle_ticks) {
+      idle_ticks = snake->ticks_per_move - snake->ticks_since_move;
+    }
+  }
+  return idle_ticks;
+}
+
+// Val: splitmix64 step, used to spread seeds out before they reach PCG.
+static uint64_t splitmix64(uint64_t *x) {
+  uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+// Val: Seed a PRNG; any seed (including nearby ones) gives an independent stream.
+void rng_seed(struct Rng *rng, uint64_t seed) {
+  rng->state = splitmix64(&seed);
+  rng->inc = splitmix64(&seed) | 1; // Stream selector must be odd.
+}
+
+// Val: Next 32 random bits.
+uint32_t rng_next(struct Rng *rng) {
+  uint64_t old = rng->state;
+  rng->state = old * 6364136223846793005ULL + rng->inc;
+  uint32_t xorshifted = ((old >> 18) ^ old) >> 27;
+  uint32_t rot = old >> 59;
+  return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+// Val: Uniform random number in [0, bound), without modulo bias.
+// Lemire's multiply-and-reject: almost never needs a division.
+uint32_t rng_below(struct Rng *rng, uint32_t bound) {
+  uint64_t m = (uint64_t) rng_next(rng) * bound;
+  uint32_t low = (uint32_t) m;
+  if (low < bound) {
+    uint32_t threshold = -bound % bound;
+    while (low < threshold) {
+      m = (uint64_t) rng_next(rng) * bound;
+      low = (uint32_t) m;
+    }
+  }
+  return m >> 32;
+}
+
+// Val: Fresh seed for a new game (time in ns, pid).
+uint64_t new_game_seed() {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  uint64_t x = (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+  x ^= (uint64_t) getpid() << 40;
+  return splitmix64(&x);
+}
+
+// Val: Read a COLSxLINES board size. Returns FALSE unless it's at least 4x4,
+// fits a replay header (u16 a side) and has cells an int can number.
+int parse_board(const char *text, int *lines, int *cols) {
+  int l;
+  int c;
+  if (sscanf(text, "%dx%d", &c, &l) != 2 || l < 4 || c < 4 || l > 0xFFFF || c > 0xFFFF
+      || (long long) l * c > INT32_MAX) {
+    return FALSE;
+  }
+  *lines = l;
+  *cols = c;
+  return TRUE;
+}
+
+// Val: Turn codes stored in replays.
+static const int replay_inputs[] = { KEY_UP, KEY_DOWN, KEY_LEFT, KEY_RIGHT, 'W', 'L' };
+#define REPLAY_INPUTS (sizeof(replay_inputs) / sizeof(replay_inputs[0]))
+
+// Val: Write out whatever is buffered.
+static void replay_flush(struct Replay *replay) {
+  fwrite(replay->data, 1, replay->len, replay->file);
+  replay->len = 0;
+}
+
+// Val: Append a byte, flushing only when the buffer fills up.
+static void replay_put(struct Replay *replay, int byte) {
+  if (replay->len == REPLAY_BUFFER_SIZE) {
+    replay_flush(replay);
+  }
+  replay->data[replay->len++] = byte;
+}
+
+// Val: Append an unsigned LEB128 varint.
+static void replay_put_varint(struct Replay *replay, unsigned long long value) {
+  while (value >= 0x80) {
+    replay_put(replay, (value & 0x7F) | 0x80);
+    value >>= 7;
+  }
+  replay_put(replay, value);
+}
+
+// Val: Start recording the game just reset into a replay file. Returns FALSE on error.
+int replay_record_start(struct GameState *game, const char *path) {
+  struct Replay *replay = &game->replay;
+  replay->file = fopen(path, "wb");
+  if (replay->file == NULL) {
+    return FALSE;
+  }
+  replay->data = malloc(REPLAY_BUFFER_SIZE);
+  if (replay->data == NULL) {
+    fclose(replay->file);
+    replay->file = NULL;
+    return FALSE;
+  }
+  replay->len = 0;
+  replay->run = 0;
+  replay->mode = REPLAY_RECORD;
+
+  replay_put(replay, 'S');
+  replay_put(replay, 'N');
+  replay_put(replay, 'K');
+  replay_put(replay, 'R');
+  replay_put(replay, REPLAY_VERSION);
+  replay_put(replay, TICKS_PER_SECOND);
+  replay_put(replay, game->pit_lines & 0xFF);
+  replay_put(replay, game->pit_lines >> 8);
+  replay_put(replay, game->pit_cols & 0xFF);
+  replay_put(replay, game->pit_cols >> 8);
+  for (int i = 0; i < 8; ++i) {
+    replay_put(replay, (game->seed >> (8 * i)) & 0xFF);
+  }
+  for (int i = 0; i < 4; ++i) {
+    replay_put(replay, (game->win_len >> (8 * i)) & 0xFF);
+  }
+  replay_put(replay, game->speed.slow & 0xFF);
+  replay_put(replay, game->speed.slow >> 8);
+  replay_put(replay, game->speed.fast & 0xFF);
+  replay_put(replay, game->speed.fast >> 8);
+  replay_put(replay, game->speed.stepped);
+  return TRUE;
+}
+
+// Val: Note the input applied on a move.
+void replay_record(struct GameState *game, int input) {
+  struct Replay *replay = &game->replay;
+  // Going straight is the common case: just count it.
+  if (input == game->snakes[0].dir) {
+    ++replay->run;
+    return;
+  }
+
+  for (int code = 0; code < (int) REPLAY_INPUTS; ++code) {
+    if (replay_inputs[code] == input) {
+      replay_put_varint(replay, replay->run);
+      replay_put(replay, code);
+      replay->run = 0;
+      return;
+    }
+  }
+
+  // Anything else keeps the direction, same as going straight.
+  ++replay->run;
+}
+
+// Val: Finish the replay file with how the game ended.
+void replay_record_finish(struct GameState *game, int game_state) {
+  struct Replay *replay = &game->replay;
+  if (replay->mode != REPLAY_RECORD) {
+    return;
+  }
+  replay_put_varint(replay, replay->run);
+  replay_put(replay, REPLAY_END);
+  replay_put(replay, game_state & 0xFF);
+  replay_flush(replay);
+
+  fclose(replay->file);
+  free(replay->data);
+  replay->data = NULL;
+  replay->mode = REPLAY_OFF;
+}
+
+// Val: Read the next varint + code pair; marks the end if the file is cut short.
+static void replay_read_turn(struct Replay *replay) {
+  unsigned long long run = 0;
+  int shift = 0;
+  while (replay->pos < replay->len) {
+    int byte = replay->data[replay->pos++];
+    run |= (unsigned long long) (byte & 0x7F) << shift;
+    shift += 7;
+    if (!(byte & 0x80)) {
+      break;
+    }
+  }
+  replay->run = run;
+  replay->code = replay->pos < replay->len ? replay->data[replay->pos++] : REPLAY_END;
+
+  if (replay->code == REPLAY_END) {
+    replay->final_state = replay->pos < replay->len ? (signed char) replay->data[replay->pos++] : PLAYING;
+  }
+}
+
+// Val: Load a replay; sets the seed and pit size for reset_snake. Returns FALSE on error.
+int replay_load(struct GameState *game, const char *path) {
+  struct Replay *replay = &game->replay;
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    return FALSE;
+  }
+
+  // Replays are small: read the whole thing up front (if it has a size:
+  // pipes don't).
+  long size = fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1;
+  unsigned char *data = size > 0 && fseek(file, 0, SEEK_SET) == 0 ? malloc(size) : NULL;
+  size_t len = data != NULL ? fread(data, 1, size, file) : 0;
+  fclose(file);
+
+  if (len < REPLAY_HEADER_SIZE || memcmp(data, "SNKR", 4) != 0
+      || data[4] != REPLAY_VERSION || data[5] != TICKS_PER_SECOND) {
+    free(data);
+    return FALSE;
+  }
+
+  // The header has to describe a game -s, -L and -d could have set up
+  // (the winning length may also be 0, for half the perimeter).
+  int lines = data[6] | data[7] << 8;
+  int cols = data[8] | data[9] << 8;
+  unsigned win_len = 0;
+  for (int i = 0; i < 4; ++i) {
+    win_len |= (unsigned) data[18 + i] << (8 * i);
+  }
+  struct SpeedCurve speed = { data[22] | data[23] << 8, data[24] | data[25] << 8, data[26] };
+  long long cells = (long long) lines * cols;
+  if (lines < 4 || cols < 4 || cells > INT32_MAX || (win_len != 0 && (win_len < 4 || win_len > cells))
+      || speed.fast < SPEED_ONE || speed.slow < speed.fast || speed.slow > SPEED_TICKS_MAX * SPEED_ONE) {
+    free(data);
+    return FALSE;
+  }
+
+  game->pit_lines = lines;
+  game->pit_cols = cols;
+  game->win_len = win_len;
+  game->speed = speed;
+  game->seed = 0;
+  for (int i = 0; i < 8; ++i) {
+    game->seed |= (unsigned long long) data[10 + i] << (8 * i);
+  }
+
+  replay->data = data;
+  replay->len = len;
+  replay->pos = REPLAY_HEADER_SIZE;
+  replay->final_state = PLAYING;
+  replay->mode = REPLAY_PLAY;
+  replay_read_turn(replay);
+  return TRUE;
+}
+
+// Val: Recorded input for the next move.
+int replay_next_input(struct GameState *game) {
+  struct Replay *replay = &game->replay;
+  if (replay->run > 0 || replay->code == REPLAY_END) {
+    --replay->run;
+    return game->snakes[0].dir;
+  }
+
+  int input = replay->code < (int) REPLAY_INPUTS ? replay_inputs[replay->code] : game->snakes[0].dir;
+  replay_read_turn(replay);
+  return input;
+}
+
+// Val: Bytes snapshot_save needs for this game.
+size_t snapshot_size(const struct GameState *game) {
+  size_t size = sizeof(struct SnapshotHeader) + sizeof(struct GameState)
+      + game_block_size(game->snakes_size, game->ring_size, game->cells_size);
+  for (int i = 0; game->chunks != NULL && i < game->chunk_rows * game->chunk_cols; ++i) {
+    size += game->chunks[i] != NULL ? sizeof(uint32_t) + PIT_CHUNK * PIT_CHUNK : 0;
+  }
+  return size;
+}
+
+// Val: Write a snapshot of the game into buf. Returns its size, 0 if buf is too small.
+size_t snapshot_save(const struct GameState *game, void *buf, size_t size) {
+  size_t needed = snapshot_size(game);
+  if (size < needed) {
+    return 0;
+  }
+
+  struct SnapshotHeader header = { { 'S', 'N', 'K', 'S' }, SNAPSHOT_VERSION, sizeof(struct GameState),
+    sizeof(struct Snake), game_block_size(game->snakes_size, game->ring_size, game->cells_size), 0, needed };
+  struct GameState copy = *game;
+  for (int i = 0; copy.chunks != NULL && i < copy.chunk_rows * copy.chunk_cols; ++i) {
+    header.chunks += copy.chunks[i] != NULL;
+  }
+
+  // Pointers mean nothing once restored; zero them so a game always
+  // snapshots to the same bytes.
+  copy.snakes = NULL;
+  copy.speed_table = NULL;
+  copy.free_cells = NULL;
+  copy.free_cells_pos = NULL;
+  copy.pit_cells = NULL;
+  copy.block = NULL;
+  copy.chunks = NULL;
+  copy.spare_chunks = NULL;
+  copy.chunks_size = 0;
+  memset(&copy.replay, 0, sizeof(copy.replay));
+
+  unsigned char *out = buf;
+  memcpy(out, &header, sizeof(header));
+  out += sizeof(header);
+  memcpy(out, &copy, sizeof(copy));
+  out += sizeof(copy);
+  memcpy(out, game->block, header.block_size);
+  for (int i = 0; i < game->snakes_size; ++i) {
+    struct Snake snake;
+    memcpy(&snake, out + i * sizeof(snake), sizeof(snake));
+    snake.elements = NULL;
+    memcpy(out + i * sizeof(snake), &snake, sizeof(snake));
+  }
+  out += header.block_size;
+  for (uint32_t i = 0; game->chunks != NULL && i < (uint32_t) (game->chunk_rows * game->chunk_cols); ++i) {
+    if (game->chunks[i] != NULL) {
+      memcpy(out, &i, sizeof(i));
+      memcpy(out + sizeof(i), game->chunks[i]->cells, PIT_CHUNK * PIT_CHUNK);
+      out += sizeof(i) + PIT_CHUNK * PIT_CHUNK;
+    }
+  }
+  return needed;
+}
+
+// Val: Replace the game with a snapshot's. Returns FALSE if it isn't a
+// snapshot this build can read, or memory ran out (the game is untouched either way).
+int snapshot_restore(struct GameState *game, const void *buf, size_t size) {
+  const unsigned char *data = buf;
+  struct SnapshotHeader header;
+  struct GameState saved;
+  if (size < sizeof(header) + sizeof(saved)) {
+    return FALSE;
+  }
+  memcpy(&header, data, sizeof(header));
+  memcpy(&saved, data + sizeof(header), sizeof(saved));
+  if (memcmp(header.magic, "SNKS", 4) != 0 || header.version != SNAPSHOT_VERSION
+      || header.game_size != sizeof(struct GameState) || header.snake_size != sizeof(struct Snake)
+      || header.size != size) {
+    return FALSE;
+  }
+
+  // The sizes have to agree with each other, or the block would be laid out
+  // past what's there.
+  int sparse = (long long) saved.pit_lines * saved.pit_cols > SPARSE_CELLS;
+  size_t chunk_bytes = sizeof(uint32_t) + PIT_CHUNK * PIT_CHUNK;
+  if (saved.pit_lines < 4 || saved.pit_lines > 0xFFFF || saved.pit_cols < 4 || saved.pit_cols > 0xFFFF
+      || saved.snakes_size < 0 || saved.snakes_size > SNAKES_MAX || saved.ring_size < 0 || saved.cells_size < 0
+      || saved.snake_count < 0 || saved.snake_count > saved.snakes_size || saved.snake_win_len > saved.ring_size
+      || (!sparse && saved.cells_size < saved.pit_lines * saved.pit_cols)
+      || (sparse && (saved.chunk_rows != (saved.pit_lines + PIT_CHUNK - 1) / PIT_CHUNK
+          || saved.chunk_cols != (saved.pit_cols + PIT_CHUNK - 1) / PIT_CHUNK))
+      || header.block_size != game_block_size(saved.snakes_size, saved.ring_size, saved.cells_size)
+      || header.chunks > (sparse ? (uint64_t) saved.chunk_rows * saved.chunk_cols : 0)
+      || size != sizeof(header) + sizeof(saved) + header.block_size + header.chunks * chunk_bytes) {
+    return FALSE;
+  }
+
+  // Whatever pointers the snapshot holds were never ours: start from none.
+  saved.snakes = NULL;
+  saved.speed_table = NULL;
+  saved.free_cells = NULL;
+  saved.free_cells_pos = NULL;
+  saved.pit_cells = NULL;
+  saved.chunks = NULL;
+  saved.chunks_size = 0;
+  saved.spare_chunks = NULL;
+  memset(&saved.replay, 0, sizeof(saved.replay));
+  saved.block = malloc(header.block_size);
+  if (saved.block == NULL) {
+    return FALSE;
+  }
+  memcpy(saved.block, data + sizeof(header) + sizeof(saved), header.block_size);
+  layout_block(&saved);
+  if (sparse) {
+    saved.chunks_size = saved.chunk_rows * saved.chunk_cols;
+    saved.chunks = calloc(saved.chunks_size, sizeof(struct PitChunk *));
+    if (saved.chunks == NULL) {
+      free(saved.block);
+      return FALSE;
+    }
+  }
+
+  // Each chunk once, somewhere on the board.
+  const unsigned char *in = data + sizeof(header) + sizeof(saved) + header.block_size;
+  int valid = snapshot_check(&saved);
+  for (uint64_t i = 0; valid && i < header.chunks; ++i, in += chunk_bytes) {
+    uint32_t index;
+    memcpy(&index, in, sizeof(index));
+    valid = index < (uint32_t) saved.chunks_size && saved.chunks[index] == NULL;
+    struct PitChunk *chunk = valid ? malloc(sizeof(struct PitChunk)) : NULL;
+    if (chunk != NULL) {
+      memcpy(chunk->cells, in + sizeof(index), PIT_CHUNK * PIT_CHUNK);
+      chunk->used = PIT_CHUNK * PIT_CHUNK - count_free(chunk->cells, PIT_CHUNK * PIT_CHUNK);
+      chunk->next = NULL;
+      saved.chunks[index] = chunk;
+    }
+    valid = chunk != NULL;
+  }
+  if (!valid) {
+    free_game(&saved);
+    return FALSE;
+  }
+  free_game(game);
+  *game = saved;
+  return TRUE;
+}
+
+// Val: Whether a game laid out from a snapshot's block is one the
+// simulation can run: every index and position in range, the free-cell
+// index agreeing with the grid.
+int snapshot_check(const struct GameState *game) {
+  long long cells = (long long) game->pit_lines * game->pit_cols;
+  if (game->snake_win_len < 1 || game->snakes_alive < 0 || game->snakes_alive > game->snake_count
+      || game->free_cells_count < 0 || game->free_cells_count > cells
+      || game->ticks_till_new_trophy < -1 || game->ticks_till_new_trophy > TICKS_PER_SECOND * 9
+      || game->trophy.value < 0 || game->trophy.value > 9
+      || (game->trophy.value > 0 && (game->trophy.pos.r <= 0 || game->trophy.pos.r >= game->pit_lines - 1
+          || game->trophy.pos.c <= 0 || game->trophy.pos.c >= game->pit_cols - 1))) {
+    return FALSE;
+  }
+
+  // Speeds are looked up by length; none can be under a tick.
+  for (int len = 0; len <= game->snake_win_len; ++len) {
+    if (game->speed_table[len] < SPEED_ONE) {
+      return FALSE;
+    }
+  }
+
+  // Dead snakes are never looked at again.
+  for (int i = 0; i < game->snake_count; ++i) {
+    const struct Snake *snake = &game->snakes[i];
+    if (!snake->alive) {
+      continue;
+    }
+    if (snake->len < 0 || snake->growth < 0 || snake->body_len < 0 || snake->body_len > game->snake_win_len
+        || snake->head_ptr < 0 || snake->head_ptr >= game->snake_win_len
+        || snake->tail_ptr < 0 || snake->tail_ptr >= game->snake_win_len
+        || (snake->body_len > 0 && (snake->tail_ptr + snake->body_len - 1) % game->snake_win_len != snake->head_ptr)
+        || (unsigned) DIR_INDEX(snake->dir) > 3 || (unsigned) DIR_INDEX(snake->prev_dir) > 3
+        || snake->ticks_per_move < 1 || snake->ticks_per_move > SPEED_TICKS_MAX
+        || snake->ticks_since_move < 0 || snake->ticks_since_move > snake->ticks_per_move
+        || snake->speed_carry < 0 || snake->speed_carry >= SPEED_ONE
+        || snake->turn_queue_head < 0 || snake->turn_queue_head >= TURN_QUEUE_MAX
+        || snake->turn_queue_len < 0 || snake->turn_queue_len > TURN_QUEUE_MAX) {
+      return FALSE;
+    }
+    for (int j = 0, ptr = snake->tail_ptr; j < snake->body_len; ++j, ptr = (ptr + 1) % game->snake_win_len) {
+      struct Coord pos = cell_coord(snake->elements[ptr]);
+      if (pos.r <= 0 || pos.r >= game->pit_lines - 1 || pos.c <= 0 || pos.c >= game->pit_cols - 1) {
+        return FALSE;
+      }
+    }
+  }
+
+  // Dense boards: each indexed cell free, at the position it says, and as
+  // many of them as the grid has inside the (always empty) border.
+  int border = 2 * (game->pit_lines + game->pit_cols - 2);
+  if (game->chunks == NULL && game->free_cells_count + border != count_free(game->pit_cells, cells)) {
+    return FALSE;
+  }
+  for (int i = 0; game->chunks == NULL && i < game->free_cells_count; ++i) {
+    int cell = game->free_cells[i];
+    if (cell < 0 || cell >= cells || game->pit_cells[cell] || game->free_cells_pos[cell] != i) {
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+// Val: Save a snapshot to a file. Returns FALSE on error.
+int snapshot_write(const struct GameState *game, const char *path) {
+  size_t size = snapshot_size(game);
+  unsigned char *data = malloc(size);
+  FILE *file = data != NULL ? fopen(path, "wb") : NULL;
+  int written = file != NULL && snapshot_save(game, data, size) == size && fwrite(data, 1, size, file) == size;
+  if (file != NULL && fclose(file) != 0) {
+    written = FALSE;
+  }
+  free(data);
+  return written;
+}
+
+// Val: Restore a snapshot from a file (mapped, not read). Returns FALSE on error.
+int snapshot_read(struct GameState *game, const char *path) {
+  int fd = open(path, O_RDONLY);
+  struct stat info;
+  if (fd < 0 || fstat(fd, &info) != 0 || info.st_size <= 0) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    return FALSE;
+  }
+  void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return FALSE;
+  }
+  int restored = snapshot_restore(game, data, info.st_size);
+  munmap(data, info.st_size);
+  return restored;
+}
+
+// Val: Make dst an independent copy of src, for searching ahead. dst is a game
+// (or zeroed); its memory is reused when it has the same shape. Returns FALSE
+// (dst freed) if out of memory.
+int fork_game(struct GameState *dst, const struct GameState *src) {
+  // A search forks the same game over and over, so keep dst's block if it's
+  // laid out the same: then the fork is one memcpy.
+  size_t block_size = game_block_size(src->snakes_size, src->ring_size, src->cells_size);
+  void *block = dst->block;
+  if (block == NULL || dst->snakes_size != src->snakes_size || dst->ring_size != src->ring_size
+      || dst->cells_size != src->cells_size) {
+    free(block);
+    dst->block = NULL;
+    block = malloc(block_size);
+    if (block == NULL) {
+      free_game(dst);
+      return FALSE;
+    }
+  }
+
+  // dst's chunks are overwritten with copies of src's first. Spares have to
+  // be all zeroes, so the ones left over are cleared before joining them.
+  struct PitChunk **chunks = dst->chunks;
+  int chunks_size = dst->chunks_size;
+  struct PitChunk *spare_chunks = dst->spare_chunks;
+  struct PitChunk *reused = NULL;
+  for (int i = 0; chunks != NULL && i < dst->chunk_rows * dst->chunk_cols; ++i) {
+    if (chunks[i] != NULL) {
+      chunks[i]->next = reused;
+      reused = chunks[i];
+    }
+  }
+  // Forks never record: a replay dst was writing is dropped unfinished.
+  if (dst->replay.file != NULL) {
+    fclose(dst->replay.file);
+  }
+  free(dst->replay.data);
+
+  *dst = *src;
+  memset(&dst->replay, 0, sizeof(dst->replay));
+  dst->block = block;
+  memcpy(dst->block, src->block, block_size);
+  layout_block(dst);
+  dst->chunks = chunks;
+  dst->chunks_size = chunks_size;
+  dst->spare_chunks = spare_chunks;
+  if (src->chunks == NULL) {
+    free(dst->chunks);
+    dst->chunks = NULL;
+    dst->chunks_size = 0;
+    spare_chunks_clear(dst, reused);
+    return TRUE;
+  }
+
+  int count = src->chunk_rows * src->chunk_cols;
+  if (count > dst->chunks_size) {
+    free(dst->chunks);
+    dst->chunks_size = count;
+    dst->chunks = malloc(sizeof(struct PitChunk *) * count);
+    if (dst->chunks == NULL) {
+      dst->chunks_size = 0;
+      spare_chunks_clear(dst, reused);
+      free_game(dst);
+      return FALSE;
+    }
+  }
+  memset(dst->chunks, 0, sizeof(struct PitChunk *) * count);
+  for (int i = 0; i < count; ++i) {
+    if (src->chunks[i] == NULL) {
+      continue;
+    }
+    struct PitChunk *chunk = reused;
+    if (chunk != NULL) {
+      reused = chunk->next;
+    } else if ((chunk = dst->spare_chunks) != NULL) {
+      dst->spare_chunks = chunk->next;
+    } else if ((chunk = malloc(sizeof(struct PitChunk))) == NULL) {
+      free_game(dst);
+      return FALSE;
+    }
+    *chunk = *src->chunks[i];
+    dst->chunks[i] = chunk;
+  }
+  spare_chunks_clear(dst, reused);
+  return TRUE;
+}
+
+// Val: Clear a list of chunks and put them on the game's spares.
+void spare_chunks_clear(struct GameState *game, struct PitChunk *chunks) {
+  while (chunks != NULL) {
+    struct PitChunk *next = chunks->next;
+    memset(chunks->cells, 0, sizeof(chunks->cells));
+    chunks->used = 0;
+    chunks->next = game->spare_chunks;
+    game->spare_chunks = chunks;
+    chunks = next;
+  }
+}
+
+// Val: Create the metrics page at path and start publishing to it. Returns FALSE on error.
+int metrics_open(const char *path) {
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return FALSE;
+  }
+  if (ftruncate(fd, sizeof(struct MetricsPage)) != 0) {
+    close(fd);
+    return FALSE;
+  }
+  void *page = mmap(NULL, sizeof(struct MetricsPage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (page == MAP_FAILED) {
+    return FALSE;
+  }
+
+  // The values start out zero (the file was just truncated); the magic goes
+  // last so a reader doesn't take a page for ready before it is.
+  metrics = page;
+  metrics->version = METRICS_VERSION;
+  metrics->pid = getpid();
+  metrics->count = METRIC_COUNT;
+  atomic_thread_fence(memory_order_release);
+  memcpy(metrics->magic, "SNKM", 4);
+  return TRUE;
+}
+
+// Val: Tally what a tick did (ticks of it) into a tally array.
+void metrics_tally(uint64_t *tally, const struct TickEvents *events, int ticks) {
+  tally[METRIC_TICKS] += ticks;
+  tally[METRIC_MOVES] += events->moved;
+  for (int i = 0; i < events->moved; ++i) {
+    tally[METRIC_EATS] += events->moves[i].ate > 0;
+  }
+  tally[METRIC_TROPHY_SPAWNS] += events->trophy_spawned;
+  tally[METRIC_SPAWN_MISSES] += events->spawn_misses;
+}
+
+// Val: Add a tally to the page (if there is one) and zero it.
+void metrics_flush(uint64_t *tally) {
+  for (int i = 0; i < METRIC_COUNT; ++i) {
+    if (metrics != NULL && tally[i] != 0) {
+      atomic_fetch_add_explicit(&metrics->values[i], tally[i], memory_order_relaxed);
+    }
+    tally[i] = 0;
+  }
+}
+
+// Val: Set a gauge on the page (if there is one).
+void metrics_set(int metric, uint64_t value) {
+  if (metrics != NULL) {
+    atomic_store_explicit(&metrics->values[metric], value, memory_order_relaxed);
+  }
+}
+
+// Val: Print another process's metrics page, one "name value" line each.
+// Returns FALSE if it isn't one.
+int metrics_print(const char *path, FILE *out) {
+  int fd = open(path, O_RDONLY);
+  struct stat info;
+  if (fd < 0 || fstat(fd, &info) != 0 || info.st_size < (off_t) sizeof(struct MetricsPage)) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    return FALSE;
+  }
+  struct MetricsPage *page = mmap(NULL, sizeof(struct MetricsPage), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (page == MAP_FAILED) {
+    return FALSE;
+  }
+  int valid = memcmp(page->magic, "SNKM", 4) == 0 && page->version == METRICS_VERSION;
+  atomic_thread_fence(memory_order_acquire);
+  if (valid) {
+    fprintf(out, "pid %u\n", page->pid);
+    for (int i = 0; i < METRIC_COUNT && i < (int) page->count; ++i) {
+      fprintf(out, "%s %llu\n", metric_names[i],
+          (unsigned long long) atomic_load_explicit(&page->values[i], memory_order_relaxed));
+    }
+  }
+  munmap(page, sizeof(struct MetricsPage));
+  return valid;
+}
+
+// Val: Queue a glyph for a cell in this frame.
+void frame_put(struct Frame *frame, struct Coord pos, int glyph) {
+  if (frame->count == FRAME_CELLS_MAX) {
+    return;
+  }
+  frame->cells[frame->count].pos = pos;
+  frame->cells[frame->count].glyph = glyph;
+  ++frame->count;
+}
+
+// Adam: Draw snake with new head.
+void draw_snake(struct GameState *game, struct SnakeMove *move, struct Frame *frame) {
+  struct Snake *snake = &game->snakes[move->snake];
+
+  if (move->tail_moved) {
+    // Snake element has been drawn and must be erased.
+    frame_put(frame, move->discarded, GLYPH_BLANK);
+  }
+
+  // Write head.
+  struct Coord head = cell_coord(snake->elements[snake->head_ptr]);
+  frame_put(frame, head, head_glyph(snake->dir));
+
+  // If snake is larger than just a head, we can draw the tail and "neck."
+  if (snake->body_len >= 2) {
+    // "Neck" first because we want the tail to clobber it for length 2.
+    struct Coord neck = cell_coord(snake->elements[(snake->head_ptr - 1 + game->snake_win_len) % game->snake_win_len]);
+    frame_put(frame, neck, body_glyph(snake->prev_dir, snake->dir));
+
+    // Tail tip.
+    struct Coord tail = cell_coord(snake->elements[snake->tail_ptr]);
+    struct Coord tail_prev = cell_coord(snake->elements[(snake->tail_ptr + 1) % game->snake_win_len]);
+    frame_put(frame, tail, tail_glyph(tail, tail_prev));
+  }
+}
+
+// Val: Glyph tables for draw_snake, by DIR_INDEX.
+static const unsigned char head_glyphs[4] = {
+  GLYPH_HEAD_DOWN, GLYPH_HEAD_UP, GLYPH_HEAD_LEFT, GLYPH_HEAD_RIGHT,
+};
+// By entering and leaving direction. Reversing is a loss, so those never show.
+static const unsigned char body_glyphs[4][4] = {
+  //   down                   up                     left                   right
+  { GLYPH_BODY_VERTICAL,   GLYPH_BODY_VERTICAL,   GLYPH_BODY_UP_LEFT,    GLYPH_BODY_UP_RIGHT },   // Down.
+  { GLYPH_BODY_VERTICAL,   GLYPH_BODY_VERTICAL,   GLYPH_BODY_DOWN_LEFT,  GLYPH_BODY_DOWN_RIGHT }, // Up.
+  { GLYPH_BODY_DOWN_RIGHT, GLYPH_BODY_UP_RIGHT,   GLYPH_BODY_HORIZONTAL, GLYPH_BODY_HORIZONTAL }, // Left.
+  { GLYPH_BODY_DOWN_LEFT,  GLYPH_BODY_UP_LEFT,    GLYPH_BODY_HORIZONTAL, GLYPH_BODY_HORIZONTAL }, // Right.
+};
+// By tail minus the segment after it, each + 1; the tip points where it's headed.
+static const unsigned char tail_glyphs[3][3] = {
+  { 0, GLYPH_TAIL_DOWN, 0 },
+  { GLYPH_TAIL_RIGHT, 0, GLYPH_TAIL_LEFT },
+  { 0, GLYPH_TAIL_UP, 0 },
+};
+
+// Val: Glyph for a head going dir.
+int head_glyph(int dir) {
+  return head_glyphs[DIR_INDEX(dir)];
+}
+
+// Val: Glyph for a segment entered going prev_dir and left going dir.
+int body_glyph(int prev_dir, int dir) {
+  return body_glyphs[DIR_INDEX(prev_dir)][DIR_INDEX(dir)];
+}
+
+// Val: Glyph for the tail tip, given the segment after it.
+int tail_glyph(struct Coord tail, struct Coord tail_prev) {
+  return tail_glyphs[tail.r - tail_prev.r + 1][tail.c - tail_prev.c + 1];
+}
+
+// Val: Direction of a one-cell step.
+static int step_dir(struct Coord from, struct Coord to) {
+  if (to.r != from.r) {
+    return to.r < from.r ? KEY_UP : KEY_DOWN;
+  }
+  return to.c < from.c ? KEY_LEFT : KEY_RIGHT;
+}
+
+// Val: Glyph a snake's segment (counted from the tail) was drawn with. A body
+// segment got its glyph when it was the neck, from the steps into and out of it.
+int segment_glyph(struct GameState *game, struct Snake *snake, int segment) {
+  int ptr = (snake->tail_ptr + segment) % game->snake_win_len;
+  struct Coord pos = cell_coord(snake->elements[ptr]);
+  struct Coord next = cell_coord(snake->elements[(ptr + 1) % game->snake_win_len]);
+  struct Coord prev = cell_coord(snake->elements[(ptr - 1 + game->snake_win_len) % game->snake_win_len]);
+  if (segment == snake->body_len - 1) {
+    return head_glyph(snake->dir);
+  } else if (segment == 0) {
+    return tail_glyph(pos, next);
+  }
+  return body_glyph(step_dir(prev, pos), step_dir(pos, next));
+}
+
+// Val: Draw the current trophy.
+void draw_trophy(struct GameState *game, struct Frame *frame) {
+  frame_put(frame, game->trophy.pos, GLYPH_TROPHY + game->trophy.value - 1);
+}
+
+#ifndef SNAKE_HEADLESS
+// Adam: Draw border around pit.
+void draw_border(struct View *view, struct GameState *game) {
+  // Draw border around snake pit (which may be smaller than the screen when replaying).
+  // Val: Or around the screen, when the pit is bigger; the pit's own walls
+  // are then drawn inside it wherever the camera sees them.
+  WINDOW *pit = derwin(view->win, view->lines, view->cols, 0, 0);
+  box(pit, 0, 0);
+  delwin(pit);
+
+  int first_c = view->origin.c + 1 > 0 ? view->origin.c + 1 : 0;
+  int last_c = view->origin.c + view->cols - 2 < game->pit_cols - 1 ? view->origin.c + view->cols - 2 : game->pit_cols - 1;
+  int first_r = view->origin.r + 1 > 0 ? view->origin.r + 1 : 0;
+  int last_r = view->origin.r + view->lines - 2 < game->pit_lines - 1 ? view->origin.r + view->lines - 2 : game->pit_lines - 1;
+  int wall_rows[2] = { 0, game->pit_lines - 1 };
+  int wall_cols[2] = { 0, game->pit_cols - 1 };
+  for (int i = 0; i < 2; ++i) {
+    int r = wall_rows[i] - view->origin.r;
+    if (r >= 1 && r <= view->lines - 2 && first_c <= last_c) {
+      mvwhline(view->win, r, first_c - view->origin.c, ACS_HLINE, last_c - first_c + 1);
+    }
+    int c = wall_cols[i] - view->origin.c;
+    if (c >= 1 && c <= view->cols - 2 && first_r <= last_r) {
+      mvwvline(view->win, first_r - view->origin.r, c, ACS_VLINE, last_r - first_r + 1);
+    }
+  }
+
+  // Add a label.
+  mvwaddstr(view->win, 0, 1, "Snake-2.0");
+}
+
+// Val: Draw what a simulation step changed.
+void render_tick(struct View *view, struct GameState *game, struct TickEvents *events) {
+  struct Frame frame;
+  frame.count = 0;
+
+  // Val: Head got near the edge of the screen: move the camera first.
+  if (aim_camera(view, game)) {
+    repaint_view(view, game);
+  }
+
+  if (events->ate) {
+    // Update win condition status.
+    hud_set(view, HUD_LENGTH, game->snakes[0].len);
+  }
+
+  PROFILE_START(draw_start);
+  for (int i = 0; i < events->moved; ++i) {
+    draw_snake(game, &events->moves[i], &frame);
+  }
+  PROFILE_END(PHASE_DRAW, draw_start);
+
+  if (events->trophy_erased) {
+    // Erase old trophy.
+    frame_put(&frame, events->erased_trophy, GLYPH_BLANK);
+  }
+
+  if (events->trophy_spawned) {
+    draw_trophy(game, &frame);
+  }
+
+  if (events->message != NULL) {
+    feedback(view, events->message);
+  }
+
+  PROFILE_START(flush_start);
+  flush_frame(view, &frame);
+  PROFILE_END(PHASE_FLUSH, flush_start);
+}
+
+// Val: Put a frame's cells on screen with a single terminal update.
+void flush_frame(struct View *view, struct Frame *frame) {
+  if (frame->count == 0 && !view->text_dirty) {
+    // Nothing changed this tick, don't touch the terminal.
+    return;
+  }
+  view->text_dirty = FALSE;
+
+  // Cells carry their own color, so the window's attributes never change.
+  for (int i = 0; i < frame->count; ++i) {
+    view_put(view, frame->cells[i].pos, frame->cells[i].glyph);
+  }
+
+  // One terminal update for everything drawn this tick.
+  long long bytes_before = bytes_written();
+  wnoutrefresh(view->win);
+#ifdef SNAKE_PROFILE
+  if (view->profile_win != NULL) {
+    // Keep the overlay on top of whatever was drawn under it.
+    touchwin(view->profile_win);
+    wnoutrefresh(view->profile_win);
+  }
+#endif
+  doupdate();
+  ++render_stats.frames;
+
+  if (bytes_before >= 0) {
+    long long frame_bytes = bytes_written() - bytes_before;
+    render_stats.bytes += frame_bytes;
+    player_tally[METRIC_RENDER_BYTES] += frame_bytes;
+    if (frame_bytes > render_stats.bytes_max) {
+      render_stats.bytes_max = frame_bytes;
+    }
+  }
+}
+
+// Val: Draw a pit cell, if the camera sees it.
+void view_put(struct View *view, struct Coord pos, int glyph) {
+  int r = pos.r - view->origin.r;
+  int c = pos.c - view->origin.c;
+  if (r >= 1 && r <= view->lines - 2 && c >= 1 && c <= view->cols - 2) {
+    mvwadd_wch(view->win, r, c, &glyph_cells[glyph]);
+  }
+}
+
+// Val: One axis of aim_camera: where a view size cells long, now starting at
+// origin, should start on a pit pit_size long so it keeps pos well inside.
+static int camera_axis(int origin, int pos, int size, int pit_size) {
+  if (pit_size <= size) {
+    return 0;
+  }
+
+  // Re-centre on pos once it's within a quarter of the view of an edge. Jumping
+  // rather than scrolling along keeps full redraws down to one every few moves.
+  int margin = (size - 2) / 4;
+  if (pos - origin < 1 + margin || pos - origin > size - 2 - margin) {
+    origin = pos - size / 2;
+  }
+
+  // Never show more past the pit than its own border.
+  if (origin < -1) {
+    origin = -1;
+  } else if (origin > pit_size - size + 1) {
+    origin = pit_size - size + 1;
+  }
+  return origin;
+}
+
+// Val: Fit the camera to the screen and keep the first snake's head well
+// inside it. Returns TRUE if it moved (then everything has to be redrawn).
+int aim_camera(struct View *view, struct GameState *game) {
+  struct Coord origin = view->origin;
+  struct Coord head = cell_coord(game->snakes[0].elements[game->snakes[0].head_ptr]);
+  view->lines = game->pit_lines < LINES ? game->pit_lines : LINES;
+  view->cols = game->pit_cols < COLS ? game->pit_cols : COLS;
+  view->origin.r = camera_axis(view->origin.r, head.r, view->lines, game->pit_lines);
+  view->origin.c = camera_axis(view->origin.c, head.c, view->cols, game->pit_cols);
+  return view->origin.r != origin.r || view->origin.c != origin.c;
+}
+
+// Val: Draw everything from scratch: border, HUD and what the camera sees.
+// Only lasts until the next flush; then draw_snake goes back to drawing just
+// what changes each move.
+void repaint_view(struct View *view, struct GameState *game) {
+  long fps = view->hud[HUD_FPS].value;
+  long tick = view->hud[HUD_TICK].value;
+  wclear(view->win);
+  draw_border(view, game);
+  view->feedback_len = 0;
+  hud_init(view, game);
+  hud_set(view, HUD_LENGTH, game->snakes[0].len);
+  hud_set(view, HUD_WIN, game->snake_win_len);
+  // The stats only come once a second, so keep showing the last ones.
+  if (fps >= 0 && tick >= 0) {
+    hud_set(view, HUD_FPS, fps);
+    hud_set(view, HUD_TICK, tick);
+  }
+  for (int i = 0; i < game->snake_count; ++i) {
+    struct Snake *snake = &game->snakes[i];
+    for (int j = 0, ptr = snake->tail_ptr; snake->alive && j < snake->body_len; ++j, ptr = (ptr + 1) % game->snake_win_len) {
+      view_put(view, cell_coord(snake->elements[ptr]), segment_glyph(game, snake, j));
+    }
+  }
+  if (game->trophy.value > 0) {
+    view_put(view, game->trophy.pos, GLYPH_TROPHY + game->trophy.value - 1);
+  }
+  view->text_dirty = TRUE;
+}
+
+// Val: Build glyph_cells from the theme, once colors are set up.
+void glyph_cells_init() {
+  for (int glyph = 0; glyph < GLYPH_COUNT; ++glyph) {
+    setcchar(&glyph_cells[glyph], glyph_styles[glyph].text, A_NORMAL, glyph_styles[glyph].color, NULL);
+  }
+}
+
+#ifdef SNAKE_PROFILE
+// Val: Monotonic time in ns.
+long long profile_now() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Val: Record one duration.
+void histogram_add(struct Histogram *histogram, long long ns) {
+  if (ns < 0) {
+    ns = 0;
+  }
+  // Below 2 << PROFILE_SUB_BITS every value has its own bucket; above, the
+  // top PROFILE_SUB_BITS + 1 bits pick it.
+  int bucket = ns;
+  if (ns >= 2 << PROFILE_SUB_BITS) {
+    int shift = 63 - __builtin_clzll(ns) - PROFILE_SUB_BITS;
+    bucket = (shift << PROFILE_SUB_BITS) + (ns >> shift);
+  }
+  ++histogram->buckets[bucket];
+  ++histogram->count;
+  if (ns > histogram->max) {
+    histogram->max = ns;
+  }
+}
+
+// Val: Value at quantile q (0-1), to within a bucket.
+long long histogram_quantile(struct Histogram *histogram, double q) {
+  long long rank = (long long) (q * histogram->count + 0.5);
+  if (rank < 1) {
+    rank = 1;
+  }
+  long long seen = 0;
+  for (int bucket = 0; bucket < PROFILE_BUCKETS; ++bucket) {
+    seen += histogram->buckets[bucket];
+    if (seen >= rank) {
+      if (bucket < 2 << PROFILE_SUB_BITS) {
+        return bucket;
+      }
+      // Middle of the bucket, but never past the largest value seen.
+      int shift = (bucket >> PROFILE_SUB_BITS) - 1;
+      long long value = ((long long) (bucket - (shift << PROFILE_SUB_BITS)) << shift) + (1LL << shift) / 2;
+      return value < histogram->max ? value : histogram->max;
+    }
+  }
+  return histogram->max;
+}
+
+static const char *const profile_names[PHASES] = { "input", "move", "award", "trophy", "draw", "flush", "sleep" };
+
+// Val: Print p50/p99/max per phase.
+void profile_report(FILE *out) {
+  fprintf(out, "%-8s %10s %10s %10s %10s\n", "phase", "count", "p50 us", "p99 us", "max us");
+  for (int phase = 0; phase < PHASES; ++phase) {
+    struct Histogram *histogram = &profile[phase];
+    fprintf(out, "%-8s %10lld %10.1f %10.1f %10.1f\n", profile_names[phase], histogram->count,
+        histogram_quantile(histogram, 0.5) / 1e3, histogram_quantile(histogram, 0.99) / 1e3, histogram->max / 1e3);
+  }
+}
+
+// Val: Show or hide the profiler overlay.
+void profile_toggle(struct View *view) {
+  if (view->profile_win != NULL) {
+    delwin(view->profile_win);
+    view->profile_win = NULL;
+    // Bring back what was underneath on the next flush.
+    touchwin(view->win);
+  } else {
+    // Top left of the pit, if it fits.
+    view->profile_win = newwin(PHASES + 1, 36, 1, 1);
+    profile_overlay(view);
+  }
+  view->text_dirty = TRUE;
+}
+
+// Val: Redraw the overlay with the latest numbers (if shown).
+void profile_overlay(struct View *view) {
+  if (view->profile_win == NULL) {
+    return;
+  }
+  mvwprintw(view->profile_win, 0, 0, "%-8s %8s %8s %8s", "phase", "p50 us", "p99 us", "max us");
+  for (int phase = 0; phase < PHASES; ++phase) {
+    struct Histogram *histogram = &profile[phase];
+    mvwprintw(view->profile_win, phase + 1, 0, "%-8s %8.1f %8.1f %8.1f", profile_names[phase],
+        histogram_quantile(histogram, 0.5) / 1e3, histogram_quantile(histogram, 0.99) / 1e3, histogram->max / 1e3);
+  }
+  view->text_dirty = TRUE;
+}
+#endif
+
+// Val: Bytes this process has written so far (-1 if unknown).
+long long bytes_written() {
+  if (proc_io_fd < 0) {
+    return -1;
+  }
 
-// Adam: Snake data tracking.
-static int snake_len = 0;
-static int snake_head_ptr = 0;
-static int snake_win_len = 0;
-static int snake_dir = KEY_RIGHT;
-static int snake_prev_dir = KEY_RIGHT;
-static struct Coord *snake_elements;
+  char buf[512];
+  ssize_t len = pread(proc_io_fd, buf, sizeof(buf) - 1, 0);
+  if (len <= 0) {
+    return -1;
+  }
+  buf[len] = '\0';
 
-// Note: default color may be -1 on some systems. Ours is 0.
-#define COLOR_DEFAULT 0
-#define COLOR_SNAKE 1
-#define COLOR_TROPHY 2
+  // "wchar" is everything passed to write(), i.e. what curses sent the terminal.
+  char *wchar = strstr(buf, "wchar:");
+  return wchar != NULL ? atoll(wchar + 6) : -1;
+}
 
-// Adam: Draw pit.
-void draw_border();
+// Val: Lay out HUD fields for the current screen and draw their labels.
+void hud_init(struct View *view, struct GameState *game) {
+  // Bottom left: "Win: len/win", both as wide as the win length.
+  int digits = snprintf(NULL, 0, "%d", game->snake_win_len);
+  // Top right: "FPS nn tick nnnnus".
+  static const struct {
+    int field;
+    const char *label;
+    int width;
+    const char *suffix;
+  } layout[HUD_FIELDS] = {
+    { HUD_LENGTH, "Win: ", 0, "" },
+    { HUD_WIN, "/", 0, "" },
+    { HUD_FPS, "FPS ", 3, "" },
+    { HUD_TICK, " tick ", 5, "us" },
+  };
 
-// Adam: Set up a new snake.
-void reset_snake();
+  int bottom_c = 2;
+  int top_c = view->cols - 2 - (4 + 3 + 6 + 5 + 2);
+  for (int i = 0; i < HUD_FIELDS; ++i) {
+    struct HudField *field = &view->hud[layout[i].field];
+    int width = layout[i].width > 0 ? layout[i].width : digits;
+    int bottom = layout[i].field == HUD_LENGTH || layout[i].field == HUD_WIN;
+    int r = bottom ? view->lines - 1 : 0;
+    int *c = bottom ? &bottom_c : &top_c;
 
-// Adam: Main game loop.
-void run_game();
+    // Leave fields out rather than writing over the corners or the label.
+    int end = *c + strlen(layout[i].label) + width + strlen(layout[i].suffix);
+    if (width > HUD_WIDTH_MAX || *c < (bottom ? 1 : 11) || end > view->cols - 1) {
+      field->width = 0;
+      continue;
+    }
 
-// Adam: Length-based speed.
-int get_ticks_per_move();
+    mvwaddstr(view->win, r, *c, layout[i].label);
+    *c += strlen(layout[i].label);
+    field->pos.r = r;
+    field->pos.c = *c;
+    field->width = width;
+    field->value = -1;
+    // Nothing is shown yet, so the first value writes every character.
+    memset(field->shown, '\0', sizeof(field->shown));
+    *c += width;
+    mvwaddstr(view->win, r, *c, layout[i].suffix);
+    *c += strlen(layout[i].suffix);
+  }
+  view->text_dirty = TRUE;
+}
 
-// Val: Generate a new trophy.
-void generate_trophy(struct Coord *trophy, int *ticks_till_new_trophy);
+// Val: Show a new value in a HUD field (only changed characters are written).
+void hud_set(struct View *view, int field_id, long value) {
+  struct HudField *field = &view->hud[field_id];
+  if (field->width == 0 || field->value == value) {
+    return;
+  }
+  field->value = value;
 
-// Val: Read user input.
-int read_input();
+  // Right-aligned, clamped to what fits.
+  char text[HUD_WIDTH_MAX + 1];
+  snprintf(text, sizeof(text), "%*ld", field->width, value);
+  if ((int) strlen(text) > field->width) {
+    memset(text, '9', field->width);
+    text[field->width] = '\0';
+  }
 
-// Val: Collision check and update next head.
-int update_next_head(int input, struct Coord *next_head);
+  for (int i = 0; i < field->width; ++i) {
+    if (text[i] != field->shown[i]) {
+      mvwaddch(view->win, field->pos.r, field->pos.c + i, text[i]);
+      field->shown[i] = text[i];
+      view->text_dirty = TRUE;
+    }
+  }
+}
+
+// Adam: Main game loop.
+int run_game(struct View *view, struct GameState *game, const char *record_path, int resumed) {
+  // Set up for a new round.
+  // Val: Unless it's resumed, which is already set up (and drawn in full below).
+  struct TickEvents events;
+  if (resumed) {
+    clear_events(&events);
+  } else if (!reset_snake(game, &events)) {
+    return FALSE;
+  }
 
-// Adam: Consume trophy and grow snake.
-int award_trophy(struct Coord *next_head, struct Coord *trophy);
+  // Put the pit and win condition on screen.
+  // Val: Looking at the head, if the pit is bigger than the screen.
+  aim_camera(view, game);
+  repaint_view(view, game);
 
-// Adam: Finalize move and draw snake with new head.
-void draw_snake(struct Coord *head);
+  // Val: Start the replay once the seed and pit are settled.
+  if (record_path != NULL && !replay_record_start(game, record_path)) {
+    feedback(view, "Can't write replay!");
+  }
 
-// Val: Print game finish status.
-void print_finish(int end);
+  render_tick(view, game, &events);
 
-// Adam: Debug/extra feedback.
-void feedback(char *content);
+  // Val: The bot's choices hang off the game's seed, like the game's own.
+  if (player_bot != NULL) {
+    rng_seed(&player_bot_state->rng, ~game->seed);
+  }
 
-// Adam: Main method.
-int main() {
-  // UTF-8 character usage via http://dillingers.com/blog/2014/08/10/ncursesw-and-unicode/.
-  // Set locale (so as to use UTF-8 characters).
-  setlocale(LC_ALL, "en_US.UTF-8");
+  int game_state = PLAYING;
+  int ticks = 1;
+  tick_clock_start(&tick_clock, NSECS_PER_TICK / replay_speed);
+  ++player_tally[METRIC_GAMES];
 
-  // Set up screen.
-  initscr();
-  curs_set(FALSE);
-  noecho();
+  // Val: FPS and average tick work time, refreshed on the HUD once a second.
+  struct timespec stats_start = tick_clock.deadline;
+  long long stats_frames = render_stats.frames;
+  long long work_ns = 0;
+  int work_ticks = 0;
 
-  // Set up colors.
-  use_default_colors();
-  start_color();
+  while (1) {
+    struct timespec work_start;
+    clock_gettime(CLOCK_MONOTONIC, &work_start);
 
-  init_pair(COLOR_SNAKE, COLOR_BLACK, COLOR_GREEN);
-  init_pair(COLOR_TROPHY, COLOR_BLACK, COLOR_YELLOW);
+    if (timespec_diff_ns(&work_start, &stats_start) >= 1000000000LL) {
+      hud_set(view, HUD_FPS, render_stats.frames - stats_frames);
+      hud_set(view, HUD_TICK, work_ticks ? work_ns / work_ticks / 1000 : 0);
+      stats_start = work_start;
+      stats_frames = render_stats.frames;
+      work_ns = 0;
+      work_ticks = 0;
+#ifdef SNAKE_PROFILE
+      profile_overlay(view);
+#endif
+    }
 
-  // Val: Set up for game input.
-  nodelay(stdscr, TRUE);
-  keypad(stdscr, TRUE);
+    // Read user input every tick so turns aren't lost between moves.
+    // (Ignored on playback, but still drained so -e doesn't spin on it.)
+    PROFILE_START(input_start);
+    read_input(view, game);
+    if (snapshot_requested) {
+      break;
+    }
+    // Val: A bot decides after the keys, so W and L still get in first.
+    if (player_bot != NULL && game->replay.mode != REPLAY_PLAY) {
+      poll_controller(game, player_bot, player_bot_state, ticks);
+    }
+    PROFILE_END(PHASE_INPUT, input_start);
 
-  run_game();
+    // Move snake, handle trophies.
+    game_state = sim_tick(game, ticks, &events);
+    render_tick(view, game, &events);
+    metrics_tally(player_tally, &events, ticks);
 
-  // Val: Clean up for normal input post-game.
-  nodelay(stdscr, FALSE);
-  flushinp();
+    struct timespec work_end;
+    clock_gettime(CLOCK_MONOTONIC, &work_end);
+    work_ns += timespec_diff_ns(&work_end, &work_start);
+    ++work_ticks;
 
-  // Pause to display screen at the end.
-  int pressed;
-  while ((pressed = getch()) == KEY_UP || pressed == KEY_DOWN || pressed == KEY_LEFT || pressed == KEY_RIGHT) {
-    // Require a non-arrow key to quit (so you can't accidentally skip the end).
+    if (game_state != PLAYING) {
+      break;
+    }
+
+    // Wait until next game tick.
+    PROFILE_START(sleep_start);
+    if (event_driven) {
+      // Nothing happens until the next move or trophy expiry, so sleep through it.
+      // A key wakes us early (ticks < idle ticks); it's queued at the top of the loop.
+      ticks = tick_clock_wait_event(&tick_clock, sim_idle_ticks(game));
+    } else {
+      tick_clock_wait(&tick_clock);
+    }
+    PROFILE_END(PHASE_SLEEP, sleep_start);
+    metrics_set(METRIC_TICK_OVERRUNS, tick_clock.overruns);
+    metrics_flush(player_tally);
   }
 
-  // Clean up after ourselves.
-  free(snake_elements);
-  endwin();
+  // Val: Saved for later rather than finished.
+  if (snapshot_requested) {
+    feedback(view, snapshot_write(game, snapshot_path) ? "Saved." : "Can't write snapshot!");
+    wrefresh(view->win);
+    return TRUE;
+  }
 
-  return 0;
-}
+  replay_record_finish(game, game_state);
 
-// Adam: Draw border around pit.
-void draw_border() {
-  // Draw border around snake pit.
-  box(stdscr, 0, 0);
+  // Print win/loss state.
+  print_finish(view, game_state);
+  return TRUE;
+}
+#endif
 
-  // Add a label.
-  move(0, 1);
-  printw("Snake-2.0");
+// Adam: Length-based speed.
+// Val: Looked up in the speed table; what's left of a tick goes to the next move.
+int get_ticks_per_move(struct GameState *game, struct Snake *snake) {
+  int len = snake->len < game->snake_win_len ? snake->len : game->snake_win_len;
+  int ticks = game->speed_table[len] + snake->speed_carry;
+  snake->speed_carry = ticks % SPEED_ONE;
+  return ticks / SPEED_ONE;
 }
 
-// Adam: Set up a new snake.
-void reset_snake() {
-  snake_len = 3;
-  snake_head_ptr = -1; // First draw will increment.
+// Val: Start the tick schedule from now.
+void tick_clock_start(struct TickClock *clock, long long tick_ns) {
+  memset(clock, 0, sizeof(*clock));
+  clock->tick_ns = tick_ns;
+  clock_gettime(CLOCK_MONOTONIC, &clock->deadline);
+}
 
-  // Length of half of the perimeter means user wins the game.
-  int new_win_len = LINES + COLS;
+// Val: Nanoseconds from b to a.
+static long long timespec_diff_ns(const struct timespec *a, const struct timespec *b) {
+  return (a->tv_sec - b->tv_sec) * 1000000000LL + (a->tv_nsec - b->tv_nsec);
+}
 
-  // If win condition increased and snake elements were allocated, we need to re-allocate for more space.
-  if (new_win_len > snake_win_len && snake_elements != NULL) {
-    free(snake_elements);
-    snake_elements = NULL;
+// Val: Wait for the next tick deadline.
+void tick_clock_wait(struct TickClock *clock) {
+  // Deadlines are absolute, so time spent on the tick's work doesn't add up.
+  clock->deadline.tv_nsec += clock->tick_ns;
+  if (clock->deadline.tv_nsec >= 1000000000L) {
+    clock->deadline.tv_nsec -= 1000000000L;
+    ++clock->deadline.tv_sec;
   }
 
-  snake_win_len = new_win_len;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  long long late = timespec_diff_ns(&now, &clock->deadline);
 
-  size_t elements_size = sizeof(struct Coord) * snake_win_len;
-
-  // Allocate array for snake elements if necessary.
-  if (snake_elements == NULL) {
-    snake_elements = malloc(elements_size);
+  if (late < 0) {
+    // On time: sleep until the deadline (retry if a signal interrupts us).
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &clock->deadline, NULL) == EINTR) {
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    late = timespec_diff_ns(&now, &clock->deadline);
+  } else if (late > clock->tick_ns * TICKS_CATCHUP_MAX) {
+    // Too far behind to catch up: drop the missed ticks and restart from now.
+    clock->deadline = now;
+    ++clock->resyncs;
+    ++clock->overruns;
+  } else {
+    // A little behind: run this tick right away to catch up.
+    ++clock->overruns;
   }
 
-  // Reset snake elements to 0.
-  memset(snake_elements, 0, elements_size);
-
-  // Initialize head in the middle of the field.
-  struct Coord head;
-  head.r = LINES / 2;
-  head.c = COLS / 2;
+  clock->jitter_ns = late;
+  clock->jitter_sum_ns += late;
+  if (late > clock->jitter_max_ns) {
+    clock->jitter_max_ns = late;
+  }
+  ++clock->ticks;
+}
 
-  // Random starting direction.
-  // Seed pseduorandom generator with current time.
-  srand(time(NULL));
-  // Use higher bits (higher bits supposedly have more even distribution).
-  snake_dir = KEY_DOWN + ((rand() >> 12) & 0x3);
-  snake_prev_dir = snake_dir;
+// Val: Block until max_ticks ticks have passed or stdin has input. Returns ticks elapsed.
+int tick_clock_wait_event(struct TickClock *clock, int max_ticks) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
 
-  // Finalize and draw snake.
-  draw_snake(&head);
-  /*char len_info[8];
-  sprintf(len_info, "win: %d", snake_win_len);
-  feedback(len_info);*/
-}
+  // Absolute time of the next due event, as a poll timeout (rounded up to whole ms).
+  long long wait_ns = clock->tick_ns * max_ticks - timespec_diff_ns(&now, &clock->deadline);
+  if (wait_ns > 0) {
+    struct pollfd in = { .fd = STDIN_FILENO, .events = POLLIN };
+    poll(&in, 1, (wait_ns + 999999) / 1000000);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+  } else {
+    ++clock->overruns;
+  }
 
-// Adam: Finalize move and draw snake with new head.
-void draw_snake(struct Coord *head) {
-  // Update head pointer.
-  snake_head_ptr = (snake_head_ptr + 1) % snake_len;
+  // Whole ticks since the last one we ran, never past the due event.
+  long long since_ns = timespec_diff_ns(&now, &clock->deadline);
+  int ticks = since_ns / clock->tick_ns;
+  if (ticks > max_ticks) {
+    ticks = max_ticks;
+  }
+  if (ticks == 0) {
+    return 0;
+  }
 
-  int discard_c = snake_elements[snake_head_ptr].c;
-  int discard_r = snake_elements[snake_head_ptr].r;
+  long long advance_ns = clock->tick_ns * ticks;
+  clock->deadline.tv_sec += advance_ns / 1000000000L;
+  clock->deadline.tv_nsec += advance_ns % 1000000000L;
+  if (clock->deadline.tv_nsec >= 1000000000L) {
+    clock->deadline.tv_nsec -= 1000000000L;
+    ++clock->deadline.tv_sec;
+  }
 
-  if (discard_c != 0 && discard_r != 0) {
-    // Snake element has been drawn and must be erased.
-    move(discard_r, discard_c);
-    addch(' ');
+  long long late = timespec_diff_ns(&now, &clock->deadline);
+  if (late > clock->tick_ns * TICKS_CATCHUP_MAX) {
+    clock->deadline = now;
+    ++clock->resyncs;
   }
 
-  snake_elements[snake_head_ptr] = *head;
+  clock->jitter_ns = late;
+  clock->jitter_sum_ns += late;
+  if (late > clock->jitter_max_ns) {
+    clock->jitter_max_ns = late;
+  }
+  clock->ticks += ticks;
 
-  // Move cursor to head location.
-  move(snake_elements[snake_head_ptr].r, snake_elements[snake_head_ptr].c);
+  return ticks;
+}
 
-  // Change to writing snake color.
-  attrset(COLOR_PAIR(COLOR_SNAKE));
+// Val: Generate a new trophy.
+void generate_trophy(struct GameState *game, struct TickEvents *events) {
+  // Magic value -1: Don't erase old trophy. Used for initial draw and when awarded.
+  if (game->ticks_till_new_trophy != -1) {
+    events->trophy_erased = TRUE;
+    events->erased_trophy = game->trophy.pos;
+  }
 
-  // Write head.
-  switch (snake_dir) {
-    case KEY_UP:
-      addwstr(L"\u2809"); // ⠉
-      break;
-    case KEY_DOWN:
-      addwstr(L"\u28C0"); // ⣀
-      break;
-    case KEY_LEFT:
-      addwstr(L"\u2806"); // ⠆
-      break;
-    case KEY_RIGHT:
-      addwstr(L"\u2830"); // ⠰
-      break;
-    default:
-      addch('@');
+  // Pick an unoccupied space for new trophy.
+  if (random_free_cell(game, &game->trophy.pos, &events->spawn_misses)) {
+    // Generate value.
+    game->trophy.value = rng_below(&game->rng, 9) + 1;
+    events->trophy_spawned = TRUE;
+  } else {
+    // Pit is full, park trophy on the border where it can't be eaten.
+    game->trophy.pos.r = 0;
+    game->trophy.pos.c = 0;
+    game->trophy.value = 0;
+    events->trophy_erased = FALSE;
   }
 
-  // If snake is larger than just a head, we can draw the tail and "neck."
-  if (snake_len >= 2) {
-    // "Neck" first because we want the tail to clobber it for length 2.
-    int ptr = (snake_head_ptr - 1 + snake_len) % snake_len;
+  // Set up expiration.
+  // 1-9 seconds, so we want to generate a number between 0-8 seconds inclusive.
+  int range = TICKS_PER_SECOND * 8 + 1;
+  game->ticks_till_new_trophy = TICKS_PER_SECOND + rng_below(&game->rng, range);
+}
 
-    if (snake_elements[ptr].r != 0 && snake_elements[ptr].c != 0) {
-      move(snake_elements[ptr].r, snake_elements[ptr].c);
+// Val: Pick a free cell inside the border uniformly. Returns FALSE if there's none.
+// Cells drawn that weren't free are added to misses (unless it's NULL).
+int random_free_cell(struct GameState *game, struct Coord *pos, int *misses) {
+  if (game->free_cells_count <= 0) {
+    return FALSE;
+  }
+  if (game->chunks == NULL) {
+    int cell = game->free_cells[rng_below(&game->rng, game->free_cells_count)];
+    pos->r = cell / game->pit_cols;
+    pos->c = cell % game->pit_cols;
+    return TRUE;
+  }
 
-      if (snake_prev_dir == snake_dir) {
-        if (snake_dir == KEY_UP || snake_dir == KEY_DOWN) {
-          addwstr(L"\u2551"); // ║
-        } else {
-          addwstr(L"\u2550"); // ═
-        }
-      } else if (snake_prev_dir == KEY_RIGHT && snake_dir == KEY_UP
-          || snake_prev_dir == KEY_DOWN && snake_dir == KEY_LEFT) {
-        addwstr(L"\u255D"); // ╝
-      } else if (snake_prev_dir == KEY_LEFT && snake_dir == KEY_UP
-          || snake_prev_dir == KEY_DOWN && snake_dir == KEY_RIGHT) {
-        addwstr(L"\u255A"); // ╚
-      } else if (snake_prev_dir == KEY_RIGHT && snake_dir == KEY_DOWN
-          || snake_prev_dir == KEY_UP && snake_dir == KEY_LEFT) {
-        addwstr(L"\u2557"); // ╗
-      } else /*if (snake_prev_dir == KEY_LEFT && snake_dir == KEY_DOWN
-          || snake_prev_dir == KEY_UP && snake_dir == KEY_RIGHT)*/ { // Final case, fall through.
-        addwstr(L"\u2554"); // ╔
-      }
+  // Sparse boards are nearly empty: draw cells until one is free. Should the
+  // snakes ever cover most of it, count off a random free cell instead.
+  for (int i = 0; i < SPARSE_TRIES; ++i) {
+    pos->r = 1 + rng_below(&game->rng, game->pit_lines - 2);
+    pos->c = 1 + rng_below(&game->rng, game->pit_cols - 2);
+    if (!pit_owner(game, pos->r, pos->c)) {
+      return TRUE;
     }
+    if (misses != NULL) {
+      ++*misses;
+    }
+  }
+  // Val: Row by row as before, but a chunk's width of a row at a time: all
+  // free if there's no chunk, otherwise counted with count_free.
+  int skip = rng_below(&game->rng, game->free_cells_count);
+  for (int r = 1; r < game->pit_lines - 1; ++r) {
+    for (int c = 1, end; c < game->pit_cols - 1; c = end) {
+      end = (c / PIT_CHUNK + 1) * PIT_CHUNK;
+      end = end < game->pit_cols - 1 ? end : game->pit_cols - 1;
+      struct PitChunk *chunk = game->chunks[r / PIT_CHUNK * game->chunk_cols + c / PIT_CHUNK];
+      const unsigned char *cells = chunk != NULL ? &chunk->cells[r % PIT_CHUNK * PIT_CHUNK + c % PIT_CHUNK] : NULL;
+      int stretch_free = cells != NULL ? count_free(cells, end - c) : end - c;
+      if (skip >= stretch_free) {
+        skip -= stretch_free;
+        continue;
+      }
 
-    // Tail tip.
-    ptr = (snake_head_ptr + 1) % snake_len;
-    int prev_ptr = (snake_head_ptr + 2) % snake_len;
-    struct Coord tail = snake_elements[ptr];
-    struct Coord tail_prev = snake_elements[prev_ptr];
-  
-    if (tail.r != 0 && tail.c != 0
-        && tail_prev.r != 0 && tail_prev.c != 0) {
-      move(tail.r, tail.c);
-      int dr = tail.r - tail_prev.r;
-      if (dr > 0) {
-        // Moving up
-        addwstr(L"\u255C"); // ╜
-      } else if (dr < 0) {
-        // Moving down
-        addwstr(L"\u2553"); // ╓
-      } else if (tail.c - tail_prev.c > 0) {
-        // Moving left
-        addwstr(L"\u2555"); // ╕
-      } else {
-        // Moving right
-        addwstr(L"\u2558"); // ╘
+      // It's in this stretch.
+      pos->r = r;
+      pos->c = c + skip;
+      for (int i = 0; cells != NULL; ++i) {
+        if (!cells[i] && skip-- == 0) {
+          pos->c = c + i;
+          break;
+        }
       }
+      return TRUE;
     }
   }
+  return FALSE;
+}
 
-  // Done drawing snake bits, reset color.
-  attrset(COLOR_PAIR(COLOR_DEFAULT));
+// Val: Free (zero) bytes among n grid cells.
+int count_free(const unsigned char *cells, int n) {
+  int count = 0;
+  for (int i = 0; i < n; ++i) {
+    count += !cells[i];
+  }
+  return count;
+}
 
-  // Refresh screen once drawn.
-  refresh();
+// Val: Chunk holding a cell on a sparse board, handed out if create and
+// there's none yet (NULL if there's none, or no memory for one).
+struct PitChunk *pit_chunk(struct GameState *game, int r, int c, int create) {
+  struct PitChunk **slot = &game->chunks[r / PIT_CHUNK * game->chunk_cols + c / PIT_CHUNK];
+  if (*slot == NULL && create) {
+    if (game->spare_chunks != NULL) {
+      *slot = game->spare_chunks;
+      game->spare_chunks = game->spare_chunks->next;
+    } else {
+      *slot = calloc(1, sizeof(struct PitChunk));
+    }
+  }
+  return *slot;
 }
 
-// Adam: Main game loop.
-void run_game() {
-  // Set up for a new round.
-  clear();
-  draw_border();
-  reset_snake();
+// Val: Mark a pit cell as occupied by the snake.
+void take_cell(struct GameState *game, int r, int c, int owner) {
+  if (game->chunks != NULL) {
+    struct PitChunk *chunk = pit_chunk(game, r, c, TRUE);
+    unsigned char *owned = chunk != NULL ? &chunk->cells[r % PIT_CHUNK * PIT_CHUNK + c % PIT_CHUNK] : NULL;
+    if (owned != NULL && !*owned) {
+      *owned = owner;
+      ++chunk->used;
+      --game->free_cells_count;
+    }
+    return;
+  }
 
-  // Put win condition on screen.
-  char *winconf = "Win: %d/%d";
-  char wincon[20];
-  sprintf(wincon, winconf, snake_len, snake_win_len);
-  feedback(wincon);
+  int cell = r * game->pit_cols + c;
+  if (game->pit_cells[cell]) {
+    return;
+  }
+  game->pit_cells[cell] = owner;
 
-  int game_state = PLAYING;
-  int input = snake_dir;
-  struct Coord next_head;
-  struct Coord trophy;
-  int ticks_till_new_trophy = 0;
+  // Swap-remove: move the last free cell into this cell's slot.
+  int pos = game->free_cells_pos[cell];
+  int last = game->free_cells[--game->free_cells_count];
+  game->free_cells[pos] = last;
+  game->free_cells_pos[last] = pos;
+}
 
-  int ticks_per_move = get_ticks_per_move();
-  int ticks_since_move = ticks_per_move;
-  while (1) {
-    // Tick counters for movement and trophy generation.
-    ++ticks_since_move;
-    --ticks_till_new_trophy;
+// Val: Mark a pit cell as free again.
+void release_cell(struct GameState *game, int r, int c) {
+  if (game->chunks != NULL) {
+    struct PitChunk *chunk = pit_chunk(game, r, c, FALSE);
+    unsigned char *owned = chunk != NULL ? &chunk->cells[r % PIT_CHUNK * PIT_CHUNK + c % PIT_CHUNK] : NULL;
+    if (owned != NULL && *owned) {
+      *owned = 0;
+      ++game->free_cells_count;
+      if (--chunk->used == 0) {
+        // Empty: back on the spare list (it's all zeroes again).
+        game->chunks[r / PIT_CHUNK * game->chunk_cols + c / PIT_CHUNK] = NULL;
+        chunk->next = game->spare_chunks;
+        game->spare_chunks = chunk;
+      }
+    }
+    return;
+  }
 
-    // Tick snake if it is supposed to move.
-    if (ticks_since_move >= ticks_per_move) {
-      // Reset ticks since snake moved.
-      ticks_since_move = 0;
+  int cell = r * game->pit_cols + c;
+  if (!game->pit_cells[cell]) {
+    return;
+  }
+  game->pit_cells[cell] = 0;
 
-      // Read user input.
-      input = read_input();
+  // Append to the end of the free list.
+  game->free_cells_pos[cell] = game->free_cells_count;
+  game->free_cells[game->free_cells_count++] = cell;
+}
 
-      // Prepare to move snake.
-      game_state = update_next_head(input, &next_head);
+// Adam: Consume trophy and grow snake. Returns value eaten (0 if none).
+int award_trophy(struct GameState *game, struct Snake *snake, struct Coord *head) {
+    // Val: value 0 is no trophy, wherever its position was left.
+    if (game->trophy.value == 0 || head->r != game->trophy.pos.r || head->c != game->trophy.pos.c) {
+      return 0;
+    }
+    // Get value of trophy.
+    int value = game->trophy.value;
+    int eaten = value;
+    // Add length for trophy.
+    snake->len += value;
 
-      // If game is over, don't wait until next tick.
-      if (game_state != PLAYING) {
-        break;
-      }
+    // Our array is only snake_win_len, don't exceed.
+    if (snake->len > game->snake_win_len) {
+      value = game->snake_win_len - snake->len + value;
+      snake->len = game->snake_win_len;
+    }
 
-      // If new head will consume trophy, award it.
-      if (award_trophy(&next_head, &trophy)) {
-        // Update speed for new length.
-        ticks_per_move = get_ticks_per_move();
-        // Prepare to draw new trophy next tick.
-        ticks_till_new_trophy = -1;
+    // Tail holds still for the next value moves instead of shifting the ring open.
+    snake->growth += value;
 
-        // Update win condition status.
-        sprintf(wincon, winconf, snake_len, snake_win_len);
-        feedback(wincon);
-      }
+    return eaten;
+}
 
-      // Draw new head.
-      draw_snake(&next_head);
+#ifndef SNAKE_HEADLESS
+// Val: Read pending keys into the turn queue.
+void read_input(struct View *view, struct GameState *game) {
+  // Queue every buffered key (at most 10 per tick, the rest wait for the next tick).
+  int temp;
+  for (int i = 0; i < 10; ++i) {
+    temp = wgetch(view->win);
 
-      // Check for a win after head has moved so trophy isn't sitting there "unconsumed" on win.
-      if (snake_len >= snake_win_len) {
-        game_state = WIN;
-        break;
-      }
+    // If there's no more input to read, buffer is clear.
+    if (temp == -1) {
+      break;
+    }
+    if (temp == KEY_RESIZE) {
+      resize_view(view, game);
+      continue;
     }
+#ifdef SNAKE_PROFILE
+    if (temp == 'p') {
+      profile_toggle(view);
+      continue;
+    }
+#endif
 
-    // Handle trophy generation.
-    // Snake moves before trophy is regenerated so that ties
-    // (snake tries to eat trophy the tick it expires)
-    // go to the player, which feels less frustrating.
-    if (ticks_till_new_trophy <= 0) {
-      generate_trophy(&trophy, &ticks_till_new_trophy);
+    if (temp == 'S' && snapshot_path != NULL) {
+      snapshot_requested = TRUE;
+      continue;
     }
 
-    // Wait until next game tick.
-    usleep(USECS_PER_TICK);
-  }
+    // Val: With a bot playing, only the cheat codes get through.
+    if (player_bot != NULL && temp != 'W' && temp != 'L') {
+      continue;
+    }
 
-  // Print win/loss state.
-  print_finish(game_state);
+    if (!queue_turn(&game->snakes[0], temp)) {
+      ++player_tally[METRIC_INPUTS_DROPPED];
+    }
+  }
 }
 
-// Adam: Length-based speed.
-int get_ticks_per_move() {
-  double delta = TICKS_PER_MOVE_MAX - TICKS_PER_MOVE_MIN + 1;
-  double ratio = snake_len;
-  ratio /= snake_win_len;
+// Val: Terminal was resized: fit the pit to it (unless a replay fixes its
+// size) and redraw everything once.
+void resize_view(struct View *view, struct GameState *game) {
+  // A replay only plays back on the pit it was recorded on.
+  // Val: And a pit given on the command line stays that size too.
+  if (game->replay.mode == REPLAY_OFF && !board_given) {
+    resize_pit(game, LINES, COLS);
+  }
 
-  return TICKS_PER_MOVE_MAX - (delta * ratio);
+  // Everything on screen is stale; curses repaints it all on the next flush.
+  aim_camera(view, game);
+  repaint_view(view, game);
 }
+#endif
 
-// Val: Generate a new trophy.
-void generate_trophy(struct Coord *trophy, int *ticks_till_new_trophy) {
-  // Magic value -1: Don't erase old trophy. Used for initial draw and when awarded.
-  if (*ticks_till_new_trophy != -1) {
-    // Erase old trophy.
-    mvaddch(trophy->r, trophy->c, ' ');
+// Val: Add a key to the turn queue (arrows and cheat codes only). Returns
+// FALSE if it was dropped because the queue is full.
+int queue_turn(struct Snake *snake, int key) {
+  // Only arrows and cheat codes mean anything to the snake.
+  if (key != KEY_UP && key != KEY_DOWN && key != KEY_LEFT && key != KEY_RIGHT
+      && key != 'W' && key != 'L') {
+    return TRUE;
   }
 
-  // Find an unoccupied space for new trophy.
-  while (1) {
-    // Generate coordinates 1 inclusive to LINES|COLS - 1 exclusive.
-    int r = rand() % (LINES - 2) + 1;
-    int c = rand() % (COLS - 2) + 1;
+  // Direction the snake will have once everything already queued is applied.
+  int last = snake->dir;
+  if (snake->turn_queue_len > 0) {
+    last = snake->turn_queue[(snake->turn_queue_head + snake->turn_queue_len - 1) % TURN_QUEUE_MAX];
+  }
 
-    int no_collide = 1;
+  // Repeats are no-ops and reversals are rejected here, before they can kill the snake.
+  if (key == last
+      || (key == KEY_UP && last == KEY_DOWN) || (key == KEY_DOWN && last == KEY_UP)
+      || (key == KEY_LEFT && last == KEY_RIGHT) || (key == KEY_RIGHT && last == KEY_LEFT)) {
+    return TRUE;
+  }
 
-    // Check if location is in body.
-    for (int i = 0; i < snake_len; ++i) {
-      if (snake_elements[i].r == r && snake_elements[i].c == c) {
-        no_collide = 0;
-        break;
-      }
-    }
+  // Queue is full: drop the key.
+  if (snake->turn_queue_len == TURN_QUEUE_MAX) {
+    return FALSE;
+  }
 
-    if (no_collide) {
-      trophy->r = r;
-      trophy->c = c;
-      break;
-    }
+  snake->turn_queue[(snake->turn_queue_head + snake->turn_queue_len) % TURN_QUEUE_MAX] = key;
+  ++snake->turn_queue_len;
+  return TRUE;
+}
+
+// Val: Take the next queued turn (current direction if none).
+int next_turn(struct Snake *snake) {
+  if (snake->turn_queue_len == 0) {
+    return snake->dir;
   }
 
-  // Generate value and draw trophy.
-  int value = (rand() % 9) + 1;
+  int turn = snake->turn_queue[snake->turn_queue_head];
+  snake->turn_queue_head = (snake->turn_queue_head + 1) % TURN_QUEUE_MAX;
+  --snake->turn_queue_len;
 
-  attrset(COLOR_PAIR(COLOR_TROPHY)); // Adam: Colors!
-  mvaddch(trophy->r, trophy->c, '0' + value);
-  attrset(COLOR_PAIR(COLOR_DEFAULT)); // Adam: Colors!
+  return turn;
+}
 
-  refresh();
+// Val: Fill in what a snake sees of its game.
+void observe(struct GameState *game, int snake, struct Observation *observation) {
+  struct Snake *self = &game->snakes[snake];
+  observation->game = game;
+  observation->snake = snake;
+  observation->head = cell_coord(self->elements[self->head_ptr]);
+  observation->dir = self->dir;
+  observation->len = self->len;
+  observation->win_len = game->snake_win_len;
+  observation->trophy = game->trophy;
+  observation->pit_lines = game->pit_lines;
+  observation->pit_cols = game->pit_cols;
+}
 
-  // Set up expiration.
-  // 1-9 seconds, so we want to generate a number between 0-8 seconds inclusive.
-  int range = TICKS_PER_SECOND * 8 + 1;
-  *ticks_till_new_trophy = TICKS_PER_SECOND + (rand() % range);
+// Val: What's in a pit cell: 0 if free, the owning snake's index + 1, or
+// OBSERVE_WALL for the border and anything outside it.
+int observe_cell(const struct Observation *observation, int r, int c) {
+  if (r <= 0 || r >= observation->pit_lines - 1 || c <= 0 || c >= observation->pit_cols - 1) {
+    return OBSERVE_WALL;
+  }
+  return pit_owner(observation->game, r, c);
 }
 
-// Adam: Consume trophy and grow snake.
-int award_trophy(struct Coord *head, struct Coord *trophy) {
-    if (head->r != trophy->r || head->c != trophy->c) {
-      return FALSE;
+// Val: Every controller, by the name -i takes.
+static const struct Controller controllers[] = {
+  { "random", random_bot },
+  { "path", path_bot },
+};
+#define CONTROLLERS (sizeof(controllers) / sizeof(controllers[0]))
+
+// Val: Controller by name (NULL if there's no such one).
+const struct Controller *find_controller(const char *name) {
+  for (int i = 0; i < (int) CONTROLLERS; ++i) {
+    if (strcmp(controllers[i].name, name) == 0) {
+      return &controllers[i];
     }
-    // Get value of trophy.
-    cchar_t trophy_val;
-    mvin_wch(trophy->r, trophy->c, &trophy_val);
-    wchar_t trophy_char;
-    attr_t attributes;
-    short color;
-
-    getcchar(&trophy_val, &trophy_char, &attributes, &color, 0);
-    int value = trophy_char - '0';
-    // Add length for trophy.
-    snake_len += value;
+  }
+  return NULL;
+}
 
-    // Our array is only snake_win_len, don't exceed.
-    if (snake_len > snake_win_len) {
-      value = snake_win_len - snake_len + value;
-      snake_len = snake_win_len;
+// Val: Queue a turn from the controller for every live snake moving within ticks.
+void poll_controller(struct GameState *game, const struct Controller *controller, struct Bot *bot, int ticks) {
+  // Decide right before a move so the queue doesn't fill with stale turns.
+  for (int i = 0; i < game->snake_count; ++i) {
+    struct Snake *snake = &game->snakes[i];
+    if (snake->alive && snake->ticks_since_move + ticks >= snake->ticks_per_move) {
+      struct Observation observation;
+      observe(game, i, &observation);
+      queue_turn(snake, controller->decide(bot, &observation));
     }
+  }
+}
+
+// Val: Steps the bots can take, in the order they try them.
+static const int bot_dirs[4] = { KEY_UP, KEY_DOWN, KEY_LEFT, KEY_RIGHT };
+static const int bot_dr[4] = { -1, 1, 0, 0 };
+static const int bot_dc[4] = { 0, 0, -1, 1 };
 
-    // Move "gap" to the current end of our circular array.
-    for (int index = snake_len - 1; index > snake_head_ptr + value; --index) {
-      int prev = index - value;
-      snake_elements[index].r = snake_elements[prev].r;
-      snake_elements[index].c = snake_elements[prev].c;
-      snake_elements[prev].r = 0;
-      snake_elements[prev].c = 0;
+// Val: Random bot: usually straight, sometimes a random turn, never into
+// something if it can be helped.
+int random_bot(struct Bot *bot, const struct Observation *observation) {
+  // Mostly try straight ahead first, sometimes a random direction.
+  // Own random state, so the game's sequence only depends on its seed.
+  int first = rng_below(&bot->rng, 4);
+  if (rng_below(&bot->rng, 8)) {
+    for (first = 0; bot_dirs[first] != observation->dir; ++first) {
     }
+  }
 
-    return TRUE;
+  for (int i = 0; i < 4; ++i) {
+    int d = (first + i) & 0x3;
+    if (observe_cell(observation, observation->head.r + bot_dr[d], observation->head.c + bot_dc[d]) == 0) {
+      return bot_dirs[d];
+    }
+  }
+
+  // Boxed in.
+  return observation->dir;
 }
 
-// Val: Read user input.
-int read_input() {
-  // Try to clear buffer to most recent input.
-  int input = snake_dir;
-  int temp;
-  for (int i = 0; i < 10; ++i) {
-    temp = getch();
+// Val: Representative of a set of first steps (see path_bot).
+static int bot_room_root(int *same, int d) {
+  while (same[d] != d) {
+    d = same[d];
+  }
+  return d;
+}
 
-    // If there's no more input to read, buffer is clear.
-    if (temp == -1) {
+// Val: Path bot: shortest path to the trophy when there's room to survive
+// getting there, otherwise the move that keeps the most room, toward the trophy.
+int path_bot(struct Bot *bot, const struct Observation *observation) {
+  struct Coord head = observation->head;
+  struct Trophy trophy = observation->trophy;
+
+  // Search a window around the head (all of a small pit), clamped to the pit.
+  int rows = observation->pit_lines < BOT_WINDOW ? observation->pit_lines : BOT_WINDOW;
+  int cols = observation->pit_cols < BOT_WINDOW ? observation->pit_cols : BOT_WINDOW;
+  int r0 = head.r - rows / 2;
+  int c0 = head.c - cols / 2;
+  r0 = r0 < 0 ? 0 : r0 > observation->pit_lines - rows ? observation->pit_lines - rows : r0;
+  c0 = c0 < 0 ? 0 : c0 > observation->pit_cols - cols ? observation->pit_cols - cols : c0;
+
+  // Fresh marks for this search; clear them once the counter wraps.
+  if (++bot->generation == 0) {
+    memset(bot->seen, 0, sizeof(bot->seen));
+    bot->generation = 1;
+  }
+
+  // Breadth-first from each free neighbour of the head, every cell noting the
+  // first step that reached it. Where two steps' searches meet they lead into
+  // the same room, so their cell counts are pooled.
+  int room[4] = { 0, 0, 0, 0 };
+  int same[4] = { 0, 1, 2, 3 };
+  int queue_head = 0;
+  int queue_tail = 0;
+  int rooms = 0;
+  int target = -1;
+  int trophy_seen = trophy.value > 0 && trophy.pos.r >= r0 && trophy.pos.r < r0 + rows
+      && trophy.pos.c >= c0 && trophy.pos.c < c0 + cols;
+  for (int d = 0; d < 4; ++d) {
+    int r = head.r + bot_dr[d];
+    int c = head.c + bot_dc[d];
+    if (observe_cell(observation, r, c) != 0) {
+      continue;
+    }
+    int cell = (r - r0) * BOT_WINDOW + (c - c0);
+    bot->seen[cell] = bot->generation;
+    bot->first[cell] = d;
+    bot->queue[queue_tail++] = cell;
+    room[d] = 1;
+    ++rooms;
+  }
+  while (queue_head < queue_tail) {
+    // Every step leads into one room that holds the snake, and the way to the
+    // trophy is known (or it's out of sight): no need to measure the rest.
+    if (rooms == 1 && queue_tail >= observation->len && (target >= 0 || !trophy_seen)) {
       break;
     }
+    int cell = bot->queue[queue_head++];
+    int r = r0 + cell / BOT_WINDOW;
+    int c = c0 + cell % BOT_WINDOW;
+    int d = bot->first[cell];
+    if (target < 0 && trophy_seen && r == trophy.pos.r && c == trophy.pos.c) {
+      target = d;
+    }
+    for (int n = 0; n < 4; ++n) {
+      int nr = r + bot_dr[n];
+      int nc = c + bot_dc[n];
+      if (nr < r0 || nr >= r0 + rows || nc < c0 || nc >= c0 + cols) {
+        continue;
+      }
+      int next = (nr - r0) * BOT_WINDOW + (nc - c0);
+      if (bot->seen[next] == bot->generation) {
+        int a = bot_room_root(same, d);
+        int b = bot_room_root(same, bot->first[next]);
+        if (a != b) {
+          same[b] = a;
+          --rooms;
+        }
+        continue;
+      }
+      if (observe_cell(observation, nr, nc) != 0) {
+        continue;
+      }
+      bot->seen[next] = bot->generation;
+      bot->first[next] = d;
+      bot->queue[queue_tail++] = next;
+      ++room[d];
+    }
+  }
 
-    // Otherwise use latest buffered input.
-    input = temp;
+  // Room behind each first step, and the most any of them has.
+  int total[4] = { 0, 0, 0, 0 };
+  int best_room = 0;
+  for (int d = 0; d < 4; ++d) {
+    total[bot_room_root(same, d)] += room[d];
+  }
+  for (int d = 0; d < 4; ++d) {
+    total[d] = room[d] > 0 ? total[bot_room_root(same, d)] : 0;
+    best_room = total[d] > best_room ? total[d] : best_room;
+  }
+  if (best_room == 0) {
+    // Boxed in.
+    return observation->dir;
   }
 
-  // Flush input in case there were over 10 keys pressed.
-  flushinp();
+  // Go for the trophy unless that means a room too small to fit in.
+  int enough = observation->len < best_room ? observation->len : best_room;
+  if (target >= 0 && total[target] >= enough) {
+    return bot_dirs[target];
+  }
 
-  return input;
+  // Otherwise the roomiest step, the one nearest the trophy among equals,
+  // straight on if that's one of them.
+  int choice = -1;
+  int choice_dist = 0;
+  for (int d = 0; d < 4; ++d) {
+    if (total[d] != best_room) {
+      continue;
+    }
+    int dist = 0;
+    if (trophy.value > 0) {
+      dist = abs(head.r + bot_dr[d] - trophy.pos.r) + abs(head.c + bot_dc[d] - trophy.pos.c);
+    }
+    if (choice < 0 || dist < choice_dist || (dist == choice_dist && bot_dirs[d] == observation->dir)) {
+      choice = d;
+      choice_dist = dist;
+    }
+  }
+  return bot_dirs[choice];
 }
 
 // Val: Collision check and update next head.
-int update_next_head(int input, struct Coord *next_head) {
+int update_next_head(struct GameState *game, struct Snake *snake, int input, struct Coord *next_head, struct TickEvents *events) {
   // Copy current head.
-  *next_head = snake_elements[snake_head_ptr];
+  *next_head = cell_coord(snake->elements[snake->head_ptr]);
 
   // Update previous direction.
-  snake_prev_dir = snake_dir;
-  snake_dir = input;
+  snake->prev_dir = snake->dir;
+  snake->dir = input;
   switch (input) {
     case KEY_UP:
     case KEY_DOWN:
@@ -478,43 +5232,43 @@ int update_next_head(int input, struct Coord *next_head) {
       break;
     // Cheat codes: win/lose. Capitals only, you have to mean it.
     case 'W':
-      feedback("You cheated!");
+      events->message = "You cheated!";
       return WIN;
     case 'L':
-      feedback("You cheated!");
+      events->message = "You cheated!";
       return LOSS;
     default:
       // Keep old snake direction.
-      snake_dir = snake_prev_dir;
+      snake->dir = snake->prev_dir;
       break;
   }
 
   // Move new head and check for inverted movement direction.
-  switch (snake_dir) {
+  switch (snake->dir) {
     case KEY_UP:
-      if (snake_prev_dir == KEY_DOWN) {
-        feedback("You can't go backwards!");
+      if (snake->prev_dir == KEY_DOWN) {
+        events->message = "You can't go backwards!";
         return LOSS;
       }
       next_head->r -= 1;
       break;
     case KEY_DOWN:
-      if (snake_prev_dir == KEY_UP) {
-        feedback("You can't go backwards!");
+      if (snake->prev_dir == KEY_UP) {
+        events->message = "You can't go backwards!";
         return LOSS;
       }
       next_head->r += 1;
       break;
     case KEY_LEFT:
-      if (snake_prev_dir == KEY_RIGHT) {
-        feedback("You can't go backwards!");
+      if (snake->prev_dir == KEY_RIGHT) {
+        events->message = "You can't go backwards!";
         return LOSS;
       }
       next_head->c -= 1;
       break;
     case KEY_RIGHT:
-      if (snake_prev_dir == KEY_LEFT) {
-        feedback("You can't go backwards!");
+      if (snake->prev_dir == KEY_LEFT) {
+        events->message = "You can't go backwards!";
         return LOSS;
       }
     default:
@@ -523,41 +5277,56 @@ int update_next_head(int input, struct Coord *next_head) {
   }
 
   // Collision checks for pit bounds:
-  if (next_head->r <= 0 || next_head->r >= LINES - 1 || next_head->c <= 0 || next_head->c >= COLS - 1) {
-    feedback("You ran into the edge of the pit!");
+  if (next_head->r <= 0 || next_head->r >= game->pit_lines - 1 || next_head->c <= 0 || next_head->c >= game->pit_cols - 1) {
+    events->message = "You ran into the edge of the pit!";
     return LOSS;
   }
 
   // Collision checks for snake elements:
-  // Skip last element (head + 1) because it will vacate its spot as head moves.
-  // Adam: Optimization: only need to check every other element.
-  // If snake length is even, check odds. If snake length is odd, check evens.
-  for (int i = 2 + ~(snake_len & 0x1); i < snake_len; i += 2) {
-    int index = (snake_head_ptr + i) % snake_len;
-    if (snake_elements[index].r == next_head->r && snake_elements[index].c == next_head->c) {
-      feedback("You hit yourself!");
-      return LOSS;
-    }
+  // Skip tail because it will vacate its spot as head moves (unless growing).
+  // Val: The grid says whose body is there, so any number of snakes is one lookup.
+  int owner = pit_owner(game, next_head->r, next_head->c);
+  if (owner != 0 && owner != snake - game->snakes + 1) {
+    events->message = "You ran into another snake!";
+    return LOSS;
+  }
+  if (owner != 0 && (snake->growth > 0 || snake->elements[snake->tail_ptr] != CELL_PACK(next_head->r, next_head->c))) {
+    events->message = "You hit yourself!";
+    return LOSS;
   }
 
   return 0;
 }
 
+#ifndef SNAKE_HEADLESS
 // Adam: Debug/extra feedback.
-void feedback(char *content) {
-  // Debug messages: center of bottom edge of pit
-  int center_shift = (COLS / 2) - (strlen(content) / 2);
-  move(LINES - 1, center_shift);
-  addstr(content);
-  refresh();
+void feedback(struct View *view, char *content) {
+  // Val: Put the border back where the previous message was.
+  if (view->feedback_len > 0) {
+    mvwhline(view->win, view->feedback_pos.r, view->feedback_pos.c, ACS_HLINE, view->feedback_len);
+  }
+
+  // Debug messages: center of bottom edge of pit (cut short between the corners).
+  // Val: Of the view, that is: the screen, if the pit is bigger.
+  int len = strlen(content);
+  if (len > view->cols - 2) {
+    len = view->cols - 2;
+  }
+  int center_shift = (view->cols / 2) - (len / 2);
+  mvwaddnstr(view->win, view->lines - 1, center_shift, content, len);
+
+  view->feedback_pos.r = view->lines - 1;
+  view->feedback_pos.c = center_shift;
+  view->feedback_len = len;
+  view->text_dirty = TRUE;
 }
 
 // Val: Print game finish status.
-void print_finish(int state) {
-  int center_r = LINES / 2;
-  int center_c = COLS / 2;
+void print_finish(struct View *view, int state) {
+  int center_r = view->lines / 2;
+  int center_c = view->cols / 2;
 
-  if (LINES < 6) {
+  if (view->lines < 6) {
     char *content;
     if (state == WIN) {
       content = "You win!";
@@ -566,9 +5335,8 @@ void print_finish(int state) {
     }
     center_c -= 4;
 
-    move(center_r, center_c);
-    addstr(content);
-    refresh();
+    mvwaddstr(view->win, center_r, center_c, content);
+    wrefresh(view->win);
     return;
   }
 
@@ -584,12 +5352,12 @@ void print_finish(int state) {
       | | (_) | |_| |  \ V  V /| | | | |_|
       \_/\___/ \__,_|   \_/\_/ |_|_| |_(_)
     */
-    mvaddstr(  center_r, center_c, "__   __                     _       _ ");
-    mvaddstr(++center_r, center_c, "\\ \\ / /                    (_)     | |");
-    mvaddstr(++center_r, center_c, " \\ V /___  _   _  __      ___ _ __ | |");
-    mvaddstr(++center_r, center_c, "  \\ // _ \\| | | | \\ \\ /\\ / / | '_ \\| |");
-    mvaddstr(++center_r, center_c, "  | | (_) | |_| |  \\ V  V /| | | | |_|");
-    mvaddstr(++center_r, center_c, "  \\_/\\___/ \\__,_|   \\_/\\_/ |_|_| |_(_)");
+    mvwaddstr(view->win,   center_r, center_c, "__   __                     _       _ ");
+    mvwaddstr(view->win, ++center_r, center_c, "\\ \\ / /                    (_)     | |");
+    mvwaddstr(view->win, ++center_r, center_c, " \\ V /___  _   _  __      ___ _ __ | |");
+    mvwaddstr(view->win, ++center_r, center_c, "  \\ // _ \\| | | | \\ \\ /\\ / / | '_ \\| |");
+    mvwaddstr(view->win, ++center_r, center_c, "  | | (_) | |_| |  \\ V  V /| | | | |_|");
+    mvwaddstr(view->win, ++center_r, center_c, "  \\_/\\___/ \\__,_|   \\_/\\_/ |_|_| |_(_)");
   } else {
     /*
     __   __            _                  
@@ -599,12 +5367,13 @@ void print_finish(int state) {
       | | (_) | |_| | | | (_) \__ \  __/_ 
       \_/\___/ \__,_| |_|\___/|___/\___(_)
     */
-    mvaddstr(  center_r, center_c, "__   __            _");
-    mvaddstr(++center_r, center_c, "\\ \\ / /           | |");
-    mvaddstr(++center_r, center_c, " \\ V /___  _   _  | | ___  ___  ___");
-    mvaddstr(++center_r, center_c, "  \\ // _ \\| | | | | |/ _ \\/ __|/ _ \\");
-    mvaddstr(++center_r, center_c, "  | | (_) | |_| | | | (_) \\__ \\  __/_ ");
-    mvaddstr(++center_r, center_c, "  \\_/\\___/ \\__,_| |_|\\___/|___/\\___(_)");
+    mvwaddstr(view->win,   center_r, center_c, "__   __            _");
+    mvwaddstr(view->win, ++center_r, center_c, "\\ \\ / /           | |");
+    mvwaddstr(view->win, ++center_r, center_c, " \\ V /___  _   _  | | ___  ___  ___");
+    mvwaddstr(view->win, ++center_r, center_c, "  \\ // _ \\| | | | | |/ _ \\/ __|/ _ \\");
+    mvwaddstr(view->win, ++center_r, center_c, "  | | (_) | |_| | | | (_) \\__ \\  __/_ ");
+    mvwaddstr(view->win, ++center_r, center_c, "  \\_/\\___/ \\__,_| |_|\\___/|___/\\___(_)");
   }
-  refresh();
+  wrefresh(view->win);
 }
+#endif